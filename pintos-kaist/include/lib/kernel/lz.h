@@ -0,0 +1,28 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+/* LZ compression.
+ *
+ * A fast LZ77 compressor in the style of LZ4, meant for page-sized
+ * buffers: it favors speed over ratio, and decompression is a
+ * simple copy loop.  The compressed format is private to this
+ * module. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest input lz_compress() accepts. */
+#define LZ_MAX_INPUT 65536
+
+/* Size of the scratch buffer lz_compress() needs. */
+#define LZ_WORK_SIZE 2048
+
+/* Returned by lz_decompress() for corrupt input. */
+#define LZ_ERROR SIZE_MAX
+
+size_t lz_compress (const void *src, size_t src_len, void *dst,
+		size_t dst_cap, void *work);
+size_t lz_decompress (const void *src, size_t src_len, void *dst,
+		size_t dst_cap);
+
+#endif /* lib/kernel/lz.h */
@@ -36,6 +36,21 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra for Project 3 */
+	SYS_MADVISE,                /* Advise on the use of memory. */
+	SYS_MMAP_FLAGS,             /* Map a file, with MAP_* flags. */
+	SYS_GET_VMSTAT,             /* Obtain virtual memory statistics. */
 };
 
+/* Flags for SYS_MMAP_FLAGS. */
+#define MAP_POPULATE 0x1            /* Load the whole mapping now. */
+
+/* Advice for SYS_MADVISE. */
+#define MADV_NORMAL 0               /* No special treatment. */
+#define MADV_RANDOM 1               /* Expect random accesses. */
+#define MADV_SEQUENTIAL 2           /* Expect sequential accesses. */
+#define MADV_WILLNEED 3             /* Expect access soon. */
+#define MADV_DONTNEED 4             /* Do not expect access soon. */
+
 #endif /* lib/syscall-nr.h */
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <syscall-nr.h>
+#include <vmstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -40,7 +42,11 @@ int dup2(int oldfd, int newfd);
 
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
+void *mmap_flags (void *addr, size_t length, int writable, int fd,
+		off_t offset, int flags);
 void munmap (void *addr);
+int madvise (void *addr, size_t length, int advice);
+bool get_vmstat (struct vmstat *);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
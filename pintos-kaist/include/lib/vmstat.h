@@ -0,0 +1,18 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+#include <stddef.h>
+
+/* Virtual memory statistics of one process, as returned by the
+   get_vmstat() system call. */
+struct vmstat {
+	long long minor_faults;     /* Faults served without I/O. */
+	long long major_faults;     /* Faults that read a file or swap. */
+	long long evictions;        /* Pages evicted. */
+	long long swap_ins;         /* Pages brought back from swap. */
+	size_t rss;                 /* Pages resident now. */
+	size_t max_rss;             /* Most pages ever resident at once. */
+	size_t swap_pages;          /* Pages in swap now. */
+};
+
+#endif /* lib/vmstat.h */
@@ -0,0 +1,37 @@
+#ifndef THREADS_MEMTRACK_H
+#define THREADS_MEMTRACK_H
+
+#include <stddef.h>
+
+/* Kernel memory allocation tracker.
+ *
+ * When the kernel is built with -DMEMTRACK (see the DEFINES line
+ * in each project's Make.vars), malloc() and the page allocator
+ * record the call site and size of every live allocation.  The
+ * report lists live bytes per call site, the peak footprint and
+ * the allocation rate.  It is printed at power-off and by the
+ * `memstat' kernel action.  Without MEMTRACK the hooks below
+ * compile to nothing. */
+
+/* Allocator that served a request. */
+enum memtrack_kind {
+	MEMTRACK_MALLOC,            /* malloc(), calloc(), realloc(). */
+	MEMTRACK_PALLOC,            /* palloc_get_page/multiple(). */
+};
+
+#ifdef MEMTRACK
+void memtrack_alloc (enum memtrack_kind, const void *site, const void *p,
+		size_t size);
+void memtrack_free (enum memtrack_kind, const void *p);
+void memtrack_print_stats (void);
+
+/* Call site of the function that invokes this macro. */
+#define MEMTRACK_SITE() __builtin_return_address (0)
+#else
+#define memtrack_alloc(KIND, SITE, P, SIZE) ((void) 0)
+#define memtrack_free(KIND, P) ((void) 0)
+#define memtrack_print_stats() ((void) 0)
+#define MEMTRACK_SITE() NULL
+#endif
+
+#endif /* threads/memtrack.h */
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -14,10 +15,26 @@ enum palloc_flags {
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
+/* Kernel pages that are never lent to the user pool. */
+extern size_t kernel_page_reserve;
+
+/* Asked to free at least PAGE_CNT kernel pages that are lent to
+   the user pool.  Returns the number of pages it freed.  It may be
+   called by an allocation made with the hook's own locks held, and
+   must then return 0 at once rather than wait for them. */
+typedef size_t palloc_reclaim_func (size_t page_cnt);
+
 uint64_t palloc_init (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_aligned (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_free_batch (void *pages[], size_t page_cnt);
+
+bool palloc_is_lent (void *page);
+void palloc_set_reclaim_hook (palloc_reclaim_func *);
+size_t palloc_free_cnt (enum palloc_flags);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -107,6 +107,8 @@ struct thread {
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	struct vmstat vmstat;               /* Paging statistics. */
+	uintptr_t user_rsp;                 /* User rsp at the last syscall. */
 #endif
 
 	/* Owned by thread.c. */
@@ -0,0 +1,31 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stddef.h>
+#include "threads/vaddr.h"
+
+/* Virtually contiguous kernel allocations.
+ *
+ * vmalloc() builds a large buffer out of individually allocated
+ * kernel pages and maps them next to each other in a reserved
+ * range of kernel virtual memory, so it does not need a
+ * physically contiguous run of pages the way malloc() and
+ * palloc_get_multiple() do.  Memory from vmalloc() has no
+ * direct-map alias: do not pass it to vtop(). */
+
+/* Reserved kernel virtual range.  It lies in the same PML4 slot
+ * as the direct map, so every page map level 4 shares it. */
+#define VMALLOC_START (KERN_BASE + 0x7fc000000UL)
+#define VMALLOC_SIZE  (256UL * 1024 * 1024)
+#define VMALLOC_END   (VMALLOC_START + VMALLOC_SIZE)
+
+#define is_vmalloc_vaddr(va) \
+	((uint64_t) (va) >= VMALLOC_START && (uint64_t) (va) < VMALLOC_END)
+
+void vmalloc_init (void);
+void *vmalloc (size_t size);
+void *vcalloc (size_t cnt, size_t size);
+void vfree (void *);
+void vmalloc_print_stats (void);
+
+#endif /* threads/vmalloc.h */
@@ -0,0 +1,20 @@
+#ifndef USERPROG_COW_H
+#define USERPROG_COW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Copy-on-write fork() for kernels built without VM.  With VM,
+ * the frame table does this job, see vm_handle_wp(). */
+
+#ifndef VM
+void cow_init (void);
+bool cow_share_page (uint64_t *pml4, uint64_t *pte, uint64_t *child_pml4,
+		void *va);
+bool cow_handle_fault (uint64_t *pml4, void *addr);
+void cow_release (uint64_t *pml4);
+#else
+#define cow_init() ((void) 0)
+#endif
+
+#endif /* userprog/cow.h */
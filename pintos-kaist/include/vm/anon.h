@@ -1,13 +1,17 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
 #include "vm/vm.h"
+#include "vm/swap.h"
 struct page;
 enum vm_type;
 
 struct anon_page {
+	swap_slot_t slot;           /* Slot holding the page, or SWAP_SLOT_NONE. */
+	struct zswap_entry *zentry; /* Compressed copy in zswap, or null. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_discard (struct page *page);
 
 #endif
@@ -3,15 +3,91 @@
 #include "filesys/file.h"
 #include "vm/vm.h"
 
+struct frame;
 struct page;
+struct supplemental_page_table;
 enum vm_type;
 
+/* An open file shared by the pages of one executable segment or
+ * one mapping, so that they take a single handle on the file
+ * rather than one each.  It is closed when the last reference
+ * goes away. */
+struct file_handle {
+	struct file *file;
+	unsigned ref_cnt;       /* Updated with interrupts off. */
+};
+
+/* A page of a file mapped by mmap(), once it has been loaded.
+ * It holds a reference to FH. */
 struct file_page {
+	struct file_handle *fh;
+	off_t ofs;              /* Offset of the page in FILE. */
+	size_t read_bytes;      /* Bytes of FILE in the page; rest is zero. */
+	bool text;              /* Shares its frame through the text cache? */
+};
+
+/* A mapping made by mmap(), kept on its process's
+ * supplemental page table until munmap() or exit. */
+struct mmap_region {
+	struct list_elem elem;  /* Element in the mmap list. */
+	struct supplemental_page_table *spt;  /* Table holding the pages. */
+	void *addr;             /* First page. */
+	size_t page_cnt;        /* Number of pages. */
+	struct file_handle *fh; /* File the pages are loaded from. */
+
+	/* Readahead state, under the readahead lock (see file.c). */
+	uint8_t *ra_next;       /* First page after the last fault's run. */
+	uint8_t *ra_end;        /* End of the pages read ahead. */
+	size_t ra_window;       /* Readahead window in pages; 0 if random. */
+	uint8_t *ra_pos;        /* Next page the readahead thread loads. */
+	uint8_t *ra_limit;      /* End of its work. */
+	struct list_elem ra_elem;  /* Element in the readahead queue. */
+	bool ra_queued;         /* In the readahead queue? */
+	bool ra_busy;           /* Readahead thread loading a page? */
+	int advice;             /* MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL. */
+};
+
+/* Where a lazily loaded page gets its contents: READ_BYTES bytes
+ * of FH's file starting at OFS, then zeroes up to the end of the
+ * page.  It is the aux of such pages while they are uninit, and
+ * it holds a reference to FH. */
+struct file_load {
+	struct file_handle *fh;
+	off_t ofs;
+	size_t read_bytes;
+	bool filled;            /* Frame already holds the page. */
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+void file_backed_discard (struct page *page);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
+void *do_mmap_flags (void *addr, size_t length, int writable,
+		struct file *file, off_t offset, int flags);
 void do_munmap (void *va);
+void mmap_region_remove (struct supplemental_page_table *,
+		struct mmap_region *);
+bool file_backed_load (struct page *, void *aux);
+void mmap_readahead (struct page *);
+void mmap_advise (struct supplemental_page_table *, void *start, void *end,
+		int advice);
+void mmap_print_stats (void);
+
+struct frame *text_cache_lookup (struct page *);
+bool text_cache_map (struct page *, struct frame *);
+void text_cache_insert (struct page *, struct frame *);
+void text_cache_remove (struct frame *);
+void text_cache_print_stats (void);
+
+struct file_handle *file_handle_open (struct file *);
+struct file_handle *file_handle_get (struct file_handle *);
+void file_handle_put (struct file_handle *);
+
+struct file_load *file_load_create (struct file_handle *, off_t ofs,
+		size_t read_bytes);
+struct file_load *file_load_dup (const struct file_load *);
+bool file_load_read (const struct file_load *, void *kva);
+bool file_load_anon (struct page *, void *aux);
+void file_load_free (struct file_load *);
 #endif
@@ -0,0 +1,52 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct frame;
+struct page;
+
+/* A page replacement policy.
+ *
+ * The frame table hands a frame to the policy once it is mapped
+ * and takes it back when it is freed or chosen for eviction.
+ * Every hook runs with the frame table lock held. */
+struct frame_policy {
+	const char *name;
+	void (*init) (size_t frame_cnt);      /* FRAME_CNT is the user pool size. */
+	void (*insert) (struct frame *);      /* FRAME was just mapped. */
+	void (*remove) (struct frame *);      /* FRAME is being freed. */
+	struct frame *(*victim) (void);       /* Detach and return a victim. */
+	void (*restore) (struct frame *);     /* Victim could not be evicted. */
+	void (*forget) (struct page *);       /* PAGE is being destroyed. */
+	void (*print_stats) (void);
+};
+
+extern const struct frame_policy clock_policy;
+extern const struct frame_policy clockpro_policy;
+
+/* -evict: Name of the replacement policy. */
+extern const char *frame_policy_name;
+
+void frame_init (void);
+struct frame *frame_alloc (void *kva);
+void frame_lock_acquire (void);
+void frame_lock_release (void);
+void frame_table_insert (struct frame *);
+void frame_table_remove (struct frame *);
+void frame_forget (struct page *);
+void frame_add_page (struct frame *, struct page *);
+void frame_remove_page (struct frame *, struct page *);
+struct frame *frame_victim (void);
+struct frame *frame_scan_next (bool *wrapped);
+bool frame_evict (struct frame *, bool unlock);
+void frame_io_begin (struct frame *);
+void frame_io_end (struct frame *);
+void frame_wait_io (struct page *);
+void frame_check_watermark (void);
+void frame_defer_destroy (uint64_t *pml4);
+bool frame_test_and_clear_accessed (struct frame *);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,22 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+struct frame;
+
+/* Values of struct frame's `ksm_state'. */
+enum ksm_state {
+	KSM_NONE,                       /* Not looked at yet. */
+	KSM_SEEN,                       /* Checksum taken on the last pass. */
+	KSM_UNSTABLE,                   /* In the unstable table. */
+	KSM_STABLE,                     /* Merged, in the stable table. */
+};
+
+/* -ksm: Frames scanned per round, or 0 to disable merging. */
+extern int ksm_pages_per_scan;
+
+void ksm_init (void);
+void ksm_forget (struct frame *);
+void ksm_write_fault (struct frame *);
+void ksm_print_stats (void);
+
+#endif /* vm/ksm.h */
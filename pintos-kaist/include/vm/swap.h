@@ -0,0 +1,22 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct disk;
+
+/* A page-sized slot on the swap disk. */
+typedef size_t swap_slot_t;
+#define SWAP_SLOT_NONE SIZE_MAX
+
+/* -swap: Swap disks, as "hdC:D[@PRIO],...", or null for hd1:1. */
+extern const char *swap_devices;
+
+void swap_init (struct disk *);
+swap_slot_t swap_write (const void *kva);
+bool swap_read (swap_slot_t, void *kva);
+void swap_free (swap_slot_t);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */
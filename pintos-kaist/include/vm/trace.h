@@ -0,0 +1,40 @@
+#ifndef VM_TRACE_H
+#define VM_TRACE_H
+
+/* Page fault latency tracer.
+ *
+ * When the kernel is built with -DVMTRACE (see the DEFINES line
+ * in vm/Make.vars), the fault path times each of the phases below
+ * with the TSC and keeps a latency histogram per phase, printed
+ * at power-off.  Without VMTRACE the hooks compile to nothing.
+ * Callers of VMTRACE_START() and VMTRACE_END() must include
+ * "intrinsic.h" for rdtsc(). */
+
+/* Timed phases of the fault path. */
+enum vmtrace_phase {
+	VMTRACE_FAULT,              /* All of vm_try_handle_fault(). */
+	VMTRACE_LOOKUP,             /* Supplemental page table lookup. */
+	VMTRACE_LOCK,               /* Waiting for the frame table lock. */
+	VMTRACE_GET_FRAME,          /* vm_get_frame(), eviction included. */
+	VMTRACE_EVICT,              /* vm_evict_frame(). */
+	VMTRACE_SWAP_IN,            /* Filling a frame: swap, file or zeroes. */
+	VMTRACE_PHASE_CNT
+};
+
+#ifdef VMTRACE
+#include <stdint.h>
+
+void vmtrace_add (enum vmtrace_phase, uint64_t cycles);
+void vmtrace_print_stats (void);
+
+/* Declares VAR and starts a span in it. */
+#define VMTRACE_START(VAR) uint64_t VAR = rdtsc ()
+/* Ends the span started in VAR and charges it to PHASE. */
+#define VMTRACE_END(PHASE, VAR) vmtrace_add (PHASE, rdtsc () - (VAR))
+#else
+#define vmtrace_print_stats() ((void) 0)
+#define VMTRACE_START(VAR) ((void) 0)
+#define VMTRACE_END(PHASE, VAR) ((void) 0)
+#endif
+
+#endif /* vm/trace.h */
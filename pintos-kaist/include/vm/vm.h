@@ -1,6 +1,10 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include <vmstat.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -36,6 +40,13 @@ struct thread;
 
 #define VM_TYPE(type) ((type) & 7)
 
+/* Marks the pages of the user stack. */
+#define VM_STACK VM_MARKER_0
+
+/* Marks the read-only pages of an executable, which share frames
+ * through the text cache (see vm/file.c). */
+#define VM_TEXT VM_MARKER_1
+
 /* The representation of "page".
  * This is kind of "parent class", which has four "child class"es, which are
  * uninit_page, file_page, anon_page, and page cache (project4).
@@ -46,6 +57,11 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	bool writable;         /* May user code write the page? */
+	struct thread *owner;  /* Thread whose page table maps the page. */
+	struct page *share_next;  /* Next page sharing the frame. */
+	bool in_test;          /* Evicted in its CLOCK-Pro test period? */
+	struct list_elem test_elem;  /* Element in CLOCK-Pro's test list. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,10 +75,20 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".  Each physical page has one,
+ * in the array of frame descriptors (see frame.c); frame_alloc()
+ * hands it out. */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;            /* First page mapping the frame. */
+	struct list_elem elem;        /* Element in a replacement policy list. */
+	struct text_entry *text;      /* Text cache entry, if any. */
+	struct hash_elem ksm_elem;    /* Element in a KSM table. */
+	uint64_t ksm_sum;             /* Checksum taken by KSM. */
+	uint8_t flags;                /* Replacement policy bits. */
+	uint8_t ksm_state;            /* enum ksm_state. */
+	bool in_table;                /* In the frame table? */
+	bool in_io;                   /* I/O under way without the frame lock? */
 };
 
 /* The function table for page operations.
@@ -82,9 +108,28 @@ struct page_operations {
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ *
+ * A radix tree with the shape of the x86-64 page tables: four
+ * levels of 512-slot nodes, indexed by the PML4, PDPE, PDX and
+ * PTX fields of the user virtual address.  Nodes are allocated
+ * on the first insert below them. */
 struct supplemental_page_table {
+	struct spt_node *root;  /* Level-4 node, or null if empty. */
+	size_t page_cnt;        /* Number of pages in the table. */
+	size_t node_cnt;        /* Number of nodes, i.e. kernel pages used. */
+	struct list mmap_list;  /* Mappings made by mmap(). */
+	struct free_batch *free_batch;  /* Set while the table is killed. */
+	void *stack_bottom;     /* Lowest page of the user stack. */
+	size_t stack_window;    /* Pages added by the last stack growth. */
+};
+
+/* Visits the pages of a supplemental page table in ascending
+ * address order.  The page just returned may be removed from the
+ * table without disturbing the iteration. */
+struct spt_iterator {
+	struct supplemental_page_table *spt;
+	uint64_t va;            /* Next address to look at. */
+	uint64_t end;           /* End of the range, exclusive. */
 };
 
 #include "threads/thread.h"
@@ -96,8 +141,21 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+void spt_first (struct spt_iterator *, struct supplemental_page_table *,
+		void *start, void *end);
+struct page *spt_next (struct spt_iterator *);
+
+/* -fault-around: Pages in the fault-around window. */
+extern int vm_fault_around_pages;
+
+/* -no-huge: Set to false to never map 2 MB pages. */
+extern bool vm_huge_pages;
+
+/* -vmstat: Print each process's statistics when it exits. */
+extern bool vm_exit_stats;
 
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -107,6 +165,12 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+bool vm_prefetch_page (struct page *page);
+void vm_populate (void *start, void *end);
+void vm_free_frame (struct page *page);
 enum vm_type page_get_type (struct page *page);
+int do_madvise (void *addr, size_t length, int advice);
+bool do_get_vmstat (struct vmstat *);
+void vm_print_exit_stats (void);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,17 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+
+struct anon_page;
+
+/* -zswap: Largest share of the user pool, in percent, that
+   compressed pages may take up.  0 disables the store. */
+extern int zswap_max_percent;
+
+void zswap_init (void);
+bool zswap_store (struct anon_page *, const void *kva);
+bool zswap_load (struct anon_page *, void *kva);
+void zswap_invalidate (struct anon_page *);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */
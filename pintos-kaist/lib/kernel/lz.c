@@ -0,0 +1,181 @@
+#include "lz.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Compressed format.
+
+   The output is a sequence of records, each one a run of literal
+   bytes followed by a match, a copy of earlier output:
+
+     token            high nibble: literal count L,
+                      low nibble: match length M - LZ_MIN_MATCH
+     [L extension]    if L >= 15: bytes added to L while 255
+     literals         L bytes
+     offset           2 bytes, little endian, distance back
+     [M extension]    if M - LZ_MIN_MATCH >= 15, as for L
+
+   The last record has literals only, and ends the input.
+
+   The compressor hashes the 4 bytes at each position into a table
+   of the last position seen with that hash, and takes the match
+   it finds there if it is real.  One probe per position makes it
+   greedy and fast. */
+
+#define LZ_MIN_MATCH 4
+#define HASH_BITS 10                /* Table of 16-bit input offsets. */
+#define MAX_OFFSET 0xffff
+
+static inline uint32_t
+read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static inline size_t
+hash (uint32_t v) {
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Appends the extension bytes of length LEN to *OP.  Returns
+   false if they do not fit before OEND. */
+static bool
+put_length (uint8_t **op, uint8_t *oend, size_t len) {
+	for (;; len -= 255) {
+		if (*op >= oend)
+			return false;
+		*(*op)++ = len < 255 ? len : 255;
+		if (len < 255)
+			return true;
+	}
+}
+
+/* Appends a record with LIT_CNT literals at LIT and a match of
+   MATCH_LEN bytes at OFFSET, or no match if MATCH_LEN is 0, to
+   *OP.  Returns false if it does not fit before OEND. */
+static bool
+put_record (uint8_t **op, uint8_t *oend, const uint8_t *lit,
+		size_t lit_cnt, size_t offset, size_t match_len) {
+	size_t m = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+	if (*op >= oend)
+		return false;
+	*(*op)++ = (lit_cnt < 15 ? lit_cnt : 15) << 4 | (m < 15 ? m : 15);
+	if (lit_cnt >= 15 && !put_length (op, oend, lit_cnt - 15))
+		return false;
+	if ((size_t) (oend - *op) < lit_cnt)
+		return false;
+	memcpy (*op, lit, lit_cnt);
+	*op += lit_cnt;
+
+	if (match_len == 0)
+		return true;
+	if (oend - *op < 2)
+		return false;
+	*(*op)++ = offset;
+	*(*op)++ = offset >> 8;
+	return m < 15 || put_length (op, oend, m - 15);
+}
+
+/* Compresses SRC_LEN bytes at SRC into DST, which has room for
+   DST_CAP bytes, using WORK, LZ_WORK_SIZE bytes, as scratch.
+   Returns the compressed size, or 0 if it would exceed DST_CAP. */
+size_t
+lz_compress (const void *src_, size_t src_len, void *dst_, size_t dst_cap,
+		void *work) {
+	const uint8_t *src = src_;
+	const uint8_t *end = src + src_len;
+	const uint8_t *ip = src, *anchor = src;
+	uint8_t *dst = dst_, *op = dst, *oend = dst + dst_cap;
+	uint16_t *table = work;
+
+	ASSERT (src_len <= LZ_MAX_INPUT);
+	ASSERT (LZ_WORK_SIZE == (1 << HASH_BITS) * sizeof *table);
+
+	memset (table, 0, LZ_WORK_SIZE);
+	while (end - ip >= LZ_MIN_MATCH) {
+		uint32_t seq = read32 (ip);
+		size_t h = hash (seq);
+		const uint8_t *ref = src + table[h];
+		const uint8_t *mp, *rp;
+
+		table[h] = ip - src;
+		if (ref >= ip || ip - ref > MAX_OFFSET || read32 (ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		mp = ip + LZ_MIN_MATCH;
+		rp = ref + LZ_MIN_MATCH;
+		while (mp < end && *mp == *rp)
+			mp++, rp++;
+		if (!put_record (&op, oend, anchor, ip - anchor, ip - ref, mp - ip))
+			return 0;
+		ip = anchor = mp;
+	}
+	if (!put_record (&op, oend, anchor, end - anchor, 0, 0))
+		return 0;
+	return op - dst;
+}
+
+/* Adds the extension bytes at *IP to *LEN.  Returns false if the
+   input ends first. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *iend, size_t *len) {
+	uint8_t b;
+
+	do {
+		if (*ip >= iend)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses SRC_LEN bytes at SRC, produced by lz_compress(),
+   into DST, which has room for DST_CAP bytes.  Returns the
+   decompressed size, or LZ_ERROR if SRC is corrupt or the output
+   would exceed DST_CAP. */
+size_t
+lz_decompress (const void *src_, size_t src_len, void *dst_,
+		size_t dst_cap) {
+	const uint8_t *ip = src_, *iend = ip + src_len;
+	uint8_t *dst = dst_, *op = dst, *oend = dst + dst_cap;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t len = token >> 4;
+		size_t offset;
+		const uint8_t *mp;
+
+		/* Literals. */
+		if (len == 15 && !get_length (&ip, iend, &len))
+			return LZ_ERROR;
+		if ((size_t) (iend - ip) < len || (size_t) (oend - op) < len)
+			return LZ_ERROR;
+		memcpy (op, ip, len);
+		op += len;
+		ip += len;
+		if (ip == iend)
+			break;
+
+		/* Match.  It may overlap its own output, so copy a byte at
+		 * a time. */
+		if (iend - ip < 2)
+			return LZ_ERROR;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		len = token & 15;
+		if (len == 15 && !get_length (&ip, iend, &len))
+			return LZ_ERROR;
+		len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| (size_t) (oend - op) < len)
+			return LZ_ERROR;
+		for (mp = op - offset; len > 0; len--)
+			*op++ = *mp++;
+	}
+	return op - dst;
+}
@@ -0,0 +1,58 @@
+/* Checks that madvise() with MADV_WILLNEED keeps the contents of
+   anonymous pages, and that MADV_DONTNEED drops them, so that
+   they read as zeros the next time they are touched. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 8
+
+static char buf[PAGE_CNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+/* Fails unless page I of buf is filled with byte C. */
+static void
+check_page (size_t i, char c)
+{
+  size_t j;
+
+  for (j = 0; j < PAGE_SIZE; j++)
+    if (buf[i * PAGE_SIZE + j] != c)
+      fail ("byte %zu of page %zu is %02hhx (should be %02hhx)",
+            j, i, buf[i * PAGE_SIZE + j], c);
+}
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (buf + i * PAGE_SIZE, 'a' + i, PAGE_SIZE);
+
+  CHECK (madvise (buf, sizeof buf, MADV_WILLNEED) == 0,
+         "madvise MADV_WILLNEED");
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (i, 'a' + i);
+  msg ("contents kept");
+
+  CHECK (madvise (buf, sizeof buf / 2, MADV_DONTNEED) == 0,
+         "madvise MADV_DONTNEED on the first half");
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (i, i < PAGE_CNT / 2 ? 0 : 'a' + i);
+  msg ("first half reads zeros, second half kept");
+
+  for (i = 0; i < PAGE_CNT / 2; i++)
+    memset (buf + i * PAGE_SIZE, 'A' + i, PAGE_SIZE);
+  for (i = 0; i < PAGE_CNT / 2; i++)
+    check_page (i, 'A' + i);
+  msg ("first half written again");
+
+  CHECK (madvise (buf + 1, PAGE_SIZE, MADV_DONTNEED) == -1,
+         "madvise of a misaligned address fails");
+  CHECK (madvise (buf, PAGE_SIZE, 99) == -1,
+         "madvise with unknown advice fails");
+  check_page (0, 'A');
+}
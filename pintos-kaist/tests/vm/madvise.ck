@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise) begin
+(madvise) madvise MADV_WILLNEED
+(madvise) contents kept
+(madvise) madvise MADV_DONTNEED on the first half
+(madvise) first half reads zeros, second half kept
+(madvise) first half written again
+(madvise) madvise of a misaligned address fails
+(madvise) madvise with unknown advice fails
+(madvise) end
+EOF
+pass;
@@ -0,0 +1,39 @@
+/* Checks that get_vmstat() counts the faults taken, and the pages
+   made resident, by touching new anonymous pages. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 8
+
+static char buf[PAGE_CNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  struct vmstat before, after;
+  long long faults;
+  size_t i;
+
+  CHECK (get_vmstat (&before), "get_vmstat before touching pages");
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * PAGE_SIZE] = 1;
+  CHECK (get_vmstat (&after), "get_vmstat after touching pages");
+
+  faults = (after.minor_faults + after.major_faults)
+           - (before.minor_faults + before.major_faults);
+  if (faults < PAGE_CNT)
+    fail ("%lld faults counted for %d new pages", faults, PAGE_CNT);
+  msg ("faults counted");
+
+  if (after.rss < before.rss + PAGE_CNT)
+    fail ("resident pages went from %zu to %zu after touching %d pages",
+          before.rss, after.rss, PAGE_CNT);
+  if (after.max_rss < after.rss)
+    fail ("max_rss %zu is below rss %zu", after.max_rss, after.rss);
+  msg ("resident pages counted");
+
+  CHECK (!get_vmstat (NULL), "get_vmstat with a null pointer fails");
+}
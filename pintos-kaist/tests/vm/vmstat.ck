@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(vmstat) begin
+(vmstat) get_vmstat before touching pages
+(vmstat) get_vmstat after touching pages
+(vmstat) faults counted
+(vmstat) resident pages counted
+(vmstat) get_vmstat with a null pointer fails
+(vmstat) end
+EOF
+pass;
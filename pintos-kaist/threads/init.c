@@ -17,20 +17,27 @@
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memtrack.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "userprog/cow.h"
 #endif
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/frame.h"
+#include "vm/ksm.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -41,6 +48,9 @@
 /* Page-map-level-4 with kernel mappings only. */
 uint64_t *base_pml4;
 
+/* Physical memory size, in 4 kB pages. */
+size_t ram_pages;
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -58,6 +68,9 @@ static char **read_command_line (void);
 static char **parse_options (char **argv);
 static void run_actions (char **argv);
 static void usage (void);
+#ifdef MEMTRACK
+static void memstat (char **argv);
+#endif
 
 static void print_stats (void);
 
@@ -84,8 +97,10 @@ main (void) {
 
 	/* Initialize memory system. */
 	mem_end = palloc_init ();
+	ram_pages = mem_end / PGSIZE;
 	malloc_init ();
 	paging_init (mem_end);
+	vmalloc_init ();
 
 #ifdef USERPROG
 	tss_init ();
@@ -100,6 +115,7 @@ main (void) {
 #ifdef USERPROG
 	exception_init ();
 	syscall_init ();
+	cow_init ();
 #endif
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
@@ -155,7 +171,7 @@ paging_init (uint64_t mem_end) {
 	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
 		uint64_t va = (uint64_t) ptov(pa);
 
-		perm = PTE_P | PTE_W;
+		perm = PTE_P | PTE_W | PTE_G;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
@@ -165,6 +181,7 @@ paging_init (uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+	tlb_init ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -221,11 +238,29 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-kr"))
+			kernel_page_reserve = atoi (value);
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-evict"))
+			frame_policy_name = value;
+		else if (!strcmp (name, "-zswap"))
+			zswap_max_percent = atoi (value);
+		else if (!strcmp (name, "-fault-around"))
+			vm_fault_around_pages = atoi (value);
+		else if (!strcmp (name, "-no-huge"))
+			vm_huge_pages = false;
+		else if (!strcmp (name, "-ksm"))
+			ksm_pages_per_scan = atoi (value);
+		else if (!strcmp (name, "-vmstat"))
+			vm_exit_stats = true;
+		else if (!strcmp (name, "-swap"))
+			swap_devices = value;
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -252,6 +287,14 @@ run_task (char **argv) {
 	printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifdef MEMTRACK
+/* Prints the memory allocation report. */
+static void
+memstat (char **argv UNUSED) {
+	memtrack_print_stats ();
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -266,6 +309,9 @@ run_actions (char **argv) {
 	/* Table of supported actions. */
 	static const struct action actions[] = {
 		{"run", 2, run_task},
+#ifdef MEMTRACK
+		{"memstat", 1, memstat},
+#endif
 #ifdef FILESYS
 		{"ls", 1, fsutil_ls},
 		{"cat", 2, fsutil_cat},
@@ -312,6 +358,9 @@ usage (void) {
 #else
 			"  run TEST           Run TEST.\n"
 #endif
+#ifdef MEMTRACK
+			"  memstat            Print kernel memory allocations by call site.\n"
+#endif
 #ifdef FILESYS
 			"  ls                 List files in the root directory.\n"
 			"  cat FILE           Print FILE to the console.\n"
@@ -326,8 +375,20 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -kr=COUNT          Never lend the last COUNT kernel pages.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -evict=POLICY      Page replacement: clockpro (default) or clock.\n"
+			"  -zswap=PERCENT     Compress up to PERCENT of user memory (20).\n"
+			"  -fault-around=N    Load up to N file pages per fault (16).\n"
+			"  -no-huge           Do not map anonymous memory with 2 MB pages.\n"
+			"  -ksm=N             Merge equal anonymous pages, scanning N\n"
+			"                     frames every 20 ms (off).\n"
+			"  -vmstat            Print paging statistics of each exiting process.\n"
+			"  -swap=DISKS        Swap to DISKS, as hdC:D[@PRIO],..., striping\n"
+			"                     among disks of equal priority (hd1:1).\n"
 #endif
 			);
 	power_off ();
@@ -354,6 +415,10 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
+	tlb_print_stats ();
+	vmalloc_print_stats ();
+	memtrack_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -362,4 +427,7 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memtrack.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -63,6 +64,8 @@ static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void *do_malloc (size_t);
+static void do_free (void *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -83,6 +86,14 @@ malloc_init (void) {
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
+	void *p = do_malloc (size);
+	memtrack_alloc (MEMTRACK_MALLOC, MEMTRACK_SITE (), p, size);
+	return p;
+}
+
+/* Does the work of malloc(), without recording the allocation. */
+static void *
+do_malloc (size_t size) {
 	struct desc *d;
 	struct block *b;
 	struct arena *a;
@@ -156,10 +167,11 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = do_malloc (size);
 	if (p != NULL)
 		memset (p, 0, size);
 
+	memtrack_alloc (MEMTRACK_MALLOC, MEMTRACK_SITE (), p, size);
 	return p;
 }
 
@@ -185,13 +197,14 @@ realloc (void *old_block, size_t new_size) {
 		free (old_block);
 		return NULL;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = do_malloc (new_size);
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
 			size_t min_size = new_size < old_size ? new_size : old_size;
 			memcpy (new_block, old_block, min_size);
 			free (old_block);
 		}
+		memtrack_alloc (MEMTRACK_MALLOC, MEMTRACK_SITE (), new_block, new_size);
 		return new_block;
 	}
 }
@@ -200,6 +213,13 @@ realloc (void *old_block, size_t new_size) {
    malloc(), calloc(), or realloc(). */
 void
 free (void *p) {
+	memtrack_free (MEMTRACK_MALLOC, p);
+	do_free (p);
+}
+
+/* Does the work of free(). */
+static void
+do_free (void *p) {
 	if (p != NULL) {
 		struct block *b = p;
 		struct arena *a = block_to_arena (b);
@@ -0,0 +1,191 @@
+#include "threads/memtrack.h"
+#ifdef MEMTRACK
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+
+/* Memory allocation tracker.
+
+   Two open-addressing hash tables with linear probing live in
+   the BSS, so recording an allocation never allocates memory
+   itself.  The site table has one entry per call site and holds
+   its counters.  The live table maps each live block to its
+   site and size, so that free() can be charged to the right
+   site.  Deletion from the live table shifts the following
+   entries back instead of leaving tombstones.
+
+   All updates run with interrupts disabled: palloc_free_page()
+   may be called from the scheduler, where locks are not
+   allowed. */
+
+#define SITE_BITS 9
+#define SITE_CNT (1 << SITE_BITS)       /* Call sites tracked. */
+#define LIVE_BITS 13
+#define LIVE_CNT (1 << LIVE_BITS)       /* Live blocks tracked. */
+#define REPORT_CNT 16                   /* Sites printed in the report. */
+
+/* Counters for one call site. */
+struct site {
+	const void *pc;             /* Return address of the allocator call. */
+	enum memtrack_kind kind;    /* Allocator used. */
+	size_t live_bytes;          /* Bytes currently allocated. */
+	size_t live_cnt;            /* Blocks currently allocated. */
+	size_t peak_bytes;          /* Maximum of live_bytes. */
+	size_t total_cnt;           /* Allocations ever made. */
+};
+
+/* One live block. */
+struct live {
+	const void *p;              /* Block address, null if slot unused. */
+	uint32_t size;              /* Block size in bytes. */
+	uint16_t site;              /* Index into sites[]. */
+	uint8_t kind;               /* enum memtrack_kind. */
+};
+
+static struct site sites[SITE_CNT];
+static struct live lives[LIVE_CNT];
+
+/* Totals, indexed by enum memtrack_kind. */
+static size_t live_bytes[2];
+static size_t peak_bytes[2];
+static size_t alloc_cnt[2];
+static size_t dropped_cnt;      /* Allocations not recorded: table full. */
+
+static const char *kind_name[] = { "malloc", "palloc" };
+
+/* Hashes pointer P into a table of 1 << BITS slots. */
+static inline size_t
+hash_ptr (const void *p, int bits) {
+	return ((uint64_t) p * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+}
+
+/* Returns the index of the site entry for PC, creating it if
+   needed, or SIZE_MAX if the site table is full. */
+static size_t
+site_lookup (enum memtrack_kind kind, const void *pc) {
+	size_t i = hash_ptr (pc, SITE_BITS);
+
+	for (size_t n = 0; n < SITE_CNT; n++, i = (i + 1) & (SITE_CNT - 1)) {
+		struct site *s = &sites[i];
+		if (s->pc == pc && s->kind == kind)
+			return i;
+		if (s->pc == NULL) {
+			s->pc = pc;
+			s->kind = kind;
+			return i;
+		}
+	}
+	return SIZE_MAX;
+}
+
+/* Records that SITE allocated SIZE bytes at P using KIND. */
+void
+memtrack_alloc (enum memtrack_kind kind, const void *site, const void *p,
+		size_t size) {
+	enum intr_level old_level;
+	size_t s, i, n;
+
+	if (p == NULL)
+		return;
+
+	old_level = intr_disable ();
+	alloc_cnt[kind]++;
+	s = site_lookup (kind, site);
+	for (i = hash_ptr (p, LIVE_BITS), n = 0; n < LIVE_CNT && lives[i].p != NULL;
+			i = (i + 1) & (LIVE_CNT - 1), n++)
+		continue;
+
+	if (s == SIZE_MAX || n == LIVE_CNT)
+		dropped_cnt++;
+	else {
+		struct site *st = &sites[s];
+		lives[i] = (struct live) {
+			.p = p, .size = size, .site = s, .kind = kind,
+		};
+		st->total_cnt++;
+		st->live_cnt++;
+		st->live_bytes += size;
+		if (st->live_bytes > st->peak_bytes)
+			st->peak_bytes = st->live_bytes;
+		live_bytes[kind] += size;
+		if (live_bytes[kind] > peak_bytes[kind])
+			peak_bytes[kind] = live_bytes[kind];
+	}
+	intr_set_level (old_level);
+}
+
+/* Records that block P, allocated with KIND, was freed. */
+void
+memtrack_free (enum memtrack_kind kind, const void *p) {
+	enum intr_level old_level;
+	size_t i, j, n;
+
+	if (p == NULL)
+		return;
+
+	old_level = intr_disable ();
+	for (i = hash_ptr (p, LIVE_BITS), n = 0; n < LIVE_CNT && lives[i].p != NULL;
+			i = (i + 1) & (LIVE_CNT - 1), n++)
+		if (lives[i].p == p && lives[i].kind == kind)
+			break;
+
+	if (n < LIVE_CNT && lives[i].p == p) {
+		struct site *st = &sites[lives[i].site];
+		st->live_cnt--;
+		st->live_bytes -= lives[i].size;
+		live_bytes[kind] -= lives[i].size;
+
+		/* Backward-shift deletion: pull later entries of the probe
+		   run into the hole whenever their home slot allows it. */
+		for (j = (i + 1) & (LIVE_CNT - 1); lives[j].p != NULL;
+				j = (j + 1) & (LIVE_CNT - 1)) {
+			size_t home = hash_ptr (lives[j].p, LIVE_BITS);
+			if (((j - home) & (LIVE_CNT - 1)) >= ((j - i) & (LIVE_CNT - 1))) {
+				lives[i] = lives[j];
+				i = j;
+			}
+		}
+		lives[i].p = NULL;
+	}
+	intr_set_level (old_level);
+}
+
+/* Prints the allocation report: totals per allocator, then the
+   REPORT_CNT call sites holding the most live memory.  Pass the
+   site addresses to the `backtrace' utility to resolve them. */
+void
+memtrack_print_stats (void) {
+	bool printed[SITE_CNT] = { false };
+	int64_t ticks = timer_ticks ();
+
+	for (int k = MEMTRACK_MALLOC; k <= MEMTRACK_PALLOC; k++)
+		printf ("Memtrack: %s: %zu bytes live, %zu bytes peak, "
+				"%zu allocs (%lld/s)\n", kind_name[k], live_bytes[k],
+				peak_bytes[k], alloc_cnt[k],
+				ticks > 0 ? (long long) alloc_cnt[k] * TIMER_FREQ / ticks : 0);
+	if (dropped_cnt > 0)
+		printf ("Memtrack: %zu allocations not tracked\n", dropped_cnt);
+
+	for (int n = 0; n < REPORT_CNT; n++) {
+		struct site *best = NULL;
+		size_t best_idx = 0;
+
+		for (size_t i = 0; i < SITE_CNT; i++)
+			if (sites[i].pc != NULL && !printed[i]
+					&& (best == NULL || sites[i].live_bytes > best->live_bytes)) {
+				best = &sites[i];
+				best_idx = i;
+			}
+		if (best == NULL || best->live_bytes == 0)
+			break;
+		printed[best_idx] = true;
+		printf ("Memtrack:   %p %s: %zu bytes in %zu blocks "
+				"(peak %zu, %zu allocs)\n", best->pc, kind_name[best->kind],
+				best->live_bytes, best->live_cnt, best->peak_bytes,
+				best->total_cnt);
+	}
+}
+#endif /* MEMTRACK */
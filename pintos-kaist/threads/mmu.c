@@ -1,18 +1,134 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* TLB tagging.
+
+   Kernel mappings are global (PTE_G), so that CR3 loads leave
+   them in the TLB, if the CPU supports global pages.
+
+   If it supports PCIDs as well, every address space is tagged
+   with one of PCID_CNT process-context identifiers, and
+   pml4_activate() loads CR3 with the no-flush bit: a process that
+   runs again finds its own translations still cached.  PCID 0
+   belongs to base_pml4.  The others are given to page maps as
+   they are activated, and taken back when their page map is
+   destroyed, or round-robin once they run out.  A PCID that
+   changes hands is flushed on its first load.
+
+   A changed PTE must then be flushed from its page map's PCID
+   even if the page map is not active.  pml4_invalidate() does it
+   with INVPCID, if the CPU has it, or else marks the PCID stale,
+   so that it is flushed as a whole on its next load.
+
+   pcids[] is covered by disabling interrupts. */
+
+#define CPUID_1_EDX_PGE (1 << 13)
+#define CPUID_1_ECX_PCID (1 << 17)
+#define CPUID_7_EBX_INVPCID (1 << 10)
+
+#define CR4_PGE (1 << 7)
+#define CR4_PCIDE (1 << 17)
+#define CR3_NOFLUSH (1ULL << 63)
+
+#define INVPCID_ADDR 0                  /* INVPCID type: one page. */
+
+#define PCID_CNT 64
+
+struct pcid {
+	uint64_t *pml4;                     /* Page map tagged, or null. */
+	bool stale;                         /* Flush on the next load? */
+};
+
+static struct pcid pcids[PCID_CNT];
+static size_t pcid_hand;                /* Next PCID to take back, less 1. */
+static bool use_pcid;                   /* CR4.PCIDE set? */
+static bool use_invpcid;                /* INVPCID available? */
+
+/* Statistics. */
+static long long load_cnt;              /* CR3 loads. */
+static long long flush_cnt;             /* ...that flushed the TLB. */
+static long long recycle_cnt;           /* PCIDs taken from a live page map. */
+static long long invpcid_cnt;           /* Pages flushed from other PCIDs. */
+static long long stale_cnt;             /* PCIDs marked stale. */
+
+/* Huge pages.
+
+   pml4_set_huge_page() maps 2 MB of user memory with one page
+   directory entry.  Every function that changes the mapping of a
+   single page first splits the huge page that covers it into a
+   page table of 512 PTEs with the same frames and bits.  The
+   caller then changes one of them and invalidates its address,
+   which flushes the 2 MB TLB entry as well.  Lookups and the
+   accessed and dirty bits do not split: they use the PDE itself,
+   so those bits are shared by the 512 pages.
+
+   Splitting must not fail, since it happens on the way to
+   unmapping a page, so each huge mapping puts a page in
+   split_reserve when it is made, and the split takes it from
+   there.  A huge mapping that is never split gives its page back
+   when its page map is destroyed.  The reserve is covered by
+   disabling interrupts. */
+
+static void *split_reserve;             /* Pages, linked by their first word. */
+static long long huge_map_cnt;          /* Huge pages mapped. */
+static long long huge_split_cnt;        /* ...and split. */
+
+/* Adds PAGE to split_reserve. */
+static void
+reserve_push (void *page) {
+	enum intr_level old_level = intr_disable ();
+
+	*(void **) page = split_reserve;
+	split_reserve = page;
+	intr_set_level (old_level);
+}
+
+/* Takes a page from split_reserve, which must not be empty. */
+static void *
+reserve_pop (void) {
+	enum intr_level old_level = intr_disable ();
+	void *page = split_reserve;
+
+	ASSERT (page != NULL);
+	split_reserve = *(void **) page;
+	intr_set_level (old_level);
+	return page;
+}
+
+/* Replaces the huge page that PDE maps with a page table that
+   maps the same frames 4 kB at a time. */
+static void
+huge_split (uint64_t *pde) {
+	uint64_t *pt = reserve_pop ();
+	uint64_t pa = *pde & ~(HUGE_PGSIZE - 1);
+	uint64_t flags = *pde & PTE_FLAGS & ~(uint64_t) PTE_PS;
+
+	for (unsigned i = 0; i < HUGE_PGCNT; i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	huge_split_cnt++;
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		/* Only a new mapping needs a 4 kB PTE in a huge page. */
+		if (((uint64_t) pte & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			if (!create)
+				return NULL;
+			huge_split (&pdp[idx]);
+		}
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -60,7 +176,8 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.  The same goes for a VADDR in a huge page:
+ * CREATE splits it. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +205,54 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page directory entry for VA in
+ * PML4, or a null pointer if there is none.  If CREATE is true,
+ * creates the tables above it as needed. */
+static uint64_t *
+pde_walk (uint64_t *pml4, const uint64_t va, bool create) {
+	uint64_t *table = pml4;
+	unsigned idx[] = { PML4 (va), PDPE (va) };
+
+	for (int i = 0; i < 2; i++) {
+		if (!(table[idx[i]] & PTE_P)) {
+			uint64_t *new_page;
+
+			if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+				return NULL;
+			table[idx[i]] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		}
+		table = ptov (PTE_ADDR (table[idx[i]]));
+	}
+	return &table[PDX (va)];
+}
+
+/* Returns the entry that maps VA in PML4, which is a PDE for a
+ * huge page, without splitting it, or a null pointer. */
+static uint64_t *
+pte_lookup (uint64_t *pml4, const void *va) {
+	uint64_t *pde = pde_walk (pml4, (uint64_t) va, false);
+
+	if (pde == NULL || !(*pde & PTE_P))
+		return NULL;
+	if (*pde & PTE_PS)
+		return pde;
+	return (uint64_t *) ptov (PTE_ADDR (*pde)) + PTX (va);
+}
+
+/* Returns the 4 kB PTE that maps VA in PML4, splitting the huge
+ * page that covers VA if there is one, or a null pointer if VA
+ * has no page table. */
+static uint64_t *
+pte_split_lookup (uint64_t *pml4, const void *va) {
+	uint64_t *pde = pde_walk (pml4, (uint64_t) va, false);
+
+	if (pde == NULL || !(*pde & PTE_P))
+		return NULL;
+	if (*pde & PTE_PS)
+		huge_split (pde);
+	return (uint64_t *) ptov (PTE_ADDR (*pde)) + PTX (va);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,7 +287,9 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		/* Huge pages are only made by the VM, which does not
+		 * use this. */
+		if (((uint64_t) pte) & PTE_P && !(pdp[i] & PTE_PS))
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
@@ -157,11 +324,15 @@ pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 
 static void
 pt_destroy (uint64_t *pt) {
+#ifndef VM
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pt[i]);
 		if (((uint64_t) pte) & PTE_P)
 			palloc_free_page ((void *) PTE_ADDR (pte));
 	}
+#endif
+	/* With VM, the frames that PT maps belong to the VM, which has
+	 * freed them already. */
 	palloc_free_page ((void *) pt);
 }
 
@@ -169,7 +340,10 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		/* The frames of a huge page belong to the VM. */
+		if (((uint64_t) pte) & PTE_P && (pdp[i] & PTE_PS))
+			palloc_free_page (reserve_pop ());
+		else if (((uint64_t) pte) & PTE_P)
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -185,6 +359,105 @@ pdpe_destroy (uint64_t *pdpe) {
 	palloc_free_page ((void *) pdpe);
 }
 
+/* Returns PML4's PCID, or 0 if it has none. */
+static size_t
+pcid_find (uint64_t *pml4) {
+	for (size_t pcid = 1; pcid < PCID_CNT; pcid++)
+		if (pcids[pcid].pml4 == pml4)
+			return pcid;
+	return 0;
+}
+
+/* Gives PML4 a PCID, taking one from another page map if none is
+   free, and returns it. */
+static size_t
+pcid_alloc (uint64_t *pml4) {
+	size_t pcid = pcid_find (NULL);
+
+	if (pcid == 0) {
+		pcid = pcid_hand + 1;
+		pcid_hand = (pcid_hand + 1) % (PCID_CNT - 1);
+		recycle_cnt++;
+	}
+	pcids[pcid].pml4 = pml4;
+	pcids[pcid].stale = true;
+	return pcid;
+}
+
+/* Turns on global pages and PCIDs, if the CPU supports them.
+   Called once base_pml4 is active, with PCID 0. */
+void
+tlb_init (void) {
+	uint32_t eax, ebx, ecx, edx, max_leaf;
+	uint64_t cr4 = rcr4 ();
+
+	cpuid (0, 0, &max_leaf, &ebx, &ecx, &edx);
+	cpuid (1, 0, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID_1_EDX_PGE))
+		return;
+	cr4 |= CR4_PGE;
+
+	/* tlb_flush_all() relies on CR4.PGE to flush every PCID. */
+	if (ecx & CPUID_1_ECX_PCID) {
+		cr4 |= CR4_PCIDE;
+		use_pcid = true;
+		pcids[0].pml4 = base_pml4;
+		if (max_leaf >= 7) {
+			cpuid (7, 0, &eax, &ebx, &ecx, &edx);
+			use_invpcid = (ebx & CPUID_7_EBX_INVPCID) != 0;
+		}
+	}
+	lcr4 (cr4);
+}
+
+/* Flushes the whole TLB, including global entries and the
+   entries of every PCID. */
+void
+tlb_flush_all (void) {
+	uint64_t cr4 = rcr4 ();
+
+	if (cr4 & CR4_PGE) {
+		lcr4 (cr4 & ~CR4_PGE);
+		lcr4 (cr4);
+	} else
+		lcr3 (rcr3 ());
+}
+
+/* Flushes user virtual page UPAGE of PML4 from the TLB, after its
+   PTE was changed. */
+void
+pml4_invalidate (uint64_t *pml4, const void *upage) {
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		invlpg ((uint64_t) upage);
+	else if (use_pcid) {
+		enum intr_level old_level = intr_disable ();
+		size_t pcid = pcid_find (pml4);
+
+		if (pcid != 0) {
+			if (use_invpcid) {
+				invpcid (INVPCID_ADDR, pcid, (uint64_t) upage);
+				invpcid_cnt++;
+			} else if (!pcids[pcid].stale) {
+				pcids[pcid].stale = true;
+				stale_cnt++;
+			}
+		}
+		intr_set_level (old_level);
+	}
+}
+
+/* Prints TLB statistics. */
+void
+tlb_print_stats (void) {
+	printf ("TLB: %s, %lld CR3 loads, %lld flushed; %lld PCIDs recycled, "
+			"%lld pages invalidated by INVPCID, %lld PCIDs marked stale\n",
+			use_pcid ? (use_invpcid ? "PCID with INVPCID" : "PCID")
+			: "no PCID", load_cnt, flush_cnt, recycle_cnt, invpcid_cnt,
+			stale_cnt);
+	printf ("TLB: %lld huge pages mapped, %lld split\n", huge_map_cnt,
+			huge_split_cnt);
+}
+
 /* Destroys pml4e, freeing all the pages it references. */
 void
 pml4_destroy (uint64_t *pml4) {
@@ -192,6 +465,16 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);
 
+	/* Its PCID goes back, and gets flushed with its next owner. */
+	if (use_pcid) {
+		enum intr_level old_level = intr_disable ();
+		size_t pcid = pcid_find (pml4);
+
+		if (pcid != 0)
+			pcids[pcid].pml4 = NULL;
+		intr_set_level (old_level);
+	}
+
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
@@ -200,10 +483,33 @@ pml4_destroy (uint64_t *pml4) {
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, keeps the TLB entries of PD's PCID. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	uint64_t cr3;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	cr3 = vtop (pml4);
+	load_cnt++;
+
+	if (use_pcid) {
+		enum intr_level old_level = intr_disable ();
+		size_t pcid = pml4 == base_pml4 ? 0 : pcid_find (pml4);
+
+		if (pml4 != base_pml4 && pcid == 0)
+			pcid = pcid_alloc (pml4);
+		if (pcids[pcid].stale) {
+			pcids[pcid].stale = false;
+			flush_cnt++;
+		} else
+			cr3 |= CR3_NOFLUSH;
+		lcr3 (cr3 | pcid);
+		intr_set_level (old_level);
+	} else {
+		flush_cnt++;
+		lcr3 (cr3);
+	}
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -214,11 +520,14 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
+	uint64_t *pte = pte_lookup (pml4, uaddr);
 
-	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
-	return NULL;
+	if (pte == NULL)
+		return NULL;
+	if (*pte & PTE_PS)
+		return ptov (*pte & ~(HUGE_PGSIZE - 1))
+			+ ((uint64_t) uaddr & (HUGE_PGSIZE - 1));
+	return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
 }
 
 /* Adds a mapping in page map level 4 PML4 from user virtual page
@@ -238,11 +547,56 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		bool was_present = (*pte & PTE_P) != 0;
+
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (was_present)
+			pml4_invalidate (pml4, upage);
+	}
 	return pte != NULL;
 }
 
+/* Maps the 2 MB of user virtual memory at UPAGE in PML4 to the
+ * 2 MB of physical memory at kernel virtual address KPAGE, with
+ * one page directory entry.  Both must be aligned to HUGE_PGSIZE,
+ * and nothing in the range may be mapped yet.  Returns true if
+ * successful, false if memory allocation failed. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	uint64_t *pde, *pt = NULL;
+	void *reserve;
+
+	ASSERT ((uint64_t) upage % HUGE_PGSIZE == 0);
+	ASSERT ((uint64_t) kpage % HUGE_PGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	if ((reserve = palloc_get_page (0)) == NULL)
+		return false;
+	pde = pde_walk (pml4, (uint64_t) upage, true);
+	if (pde == NULL) {
+		palloc_free_page (reserve);
+		return false;
+	}
+
+	/* A page table left over from earlier 4 kB mappings. */
+	if (*pde & PTE_P) {
+		pt = ptov (PTE_ADDR (*pde));
+		for (unsigned i = 0; i < HUGE_PGCNT; i++)
+			ASSERT (!(pt[i] & PTE_P));
+	}
+
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	if (pt != NULL) {
+		pml4_invalidate (pml4, upage);
+		palloc_free_page (pt);
+	}
+	reserve_push (reserve);
+	huge_map_cnt++;
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
@@ -253,63 +607,84 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (is_user_vaddr (upage));
 
-	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	pte = pte_split_lookup (pml4, upage);
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		pml4_invalidate (pml4, upage);
 	}
 }
 
+/* Marks user virtual page UPAGE, which pml4_clear_page() marked
+ * "not present", present again.  The rest of the page table
+ * entry, the accessed and dirty bits included, is kept as it was.
+ * Returns false if PML4 contains no PTE for UPAGE. */
+bool
+pml4_restore_page (uint64_t *pml4, void *upage) {
+	uint64_t *pte;
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pte = pte_lookup (pml4, upage);
+	if (pte == NULL)
+		return false;
+	*pte |= PTE_P;
+	return true;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
  * installed.
  * Returns false if PML4 contains no PTE for VPAGE. */
 bool
 pml4_is_dirty (uint64_t *pml4, const void *vpage) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = pte_lookup (pml4, vpage);
 	return pte != NULL && (*pte & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
- * in PML4. */
+ * in PML4, or in the PDE if VPAGE is in a huge page. */
 void
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = pte_lookup (pml4, vpage);
 	if (pte) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
-			*pte &= ~(uint32_t) PTE_D;
+			*pte &= ~(uint64_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		pml4_invalidate (pml4, vpage);
 	}
 }
 
+/* Returns true if VPAGE is mapped by a huge page in PML4. */
+bool
+pml4_is_huge (uint64_t *pml4, const void *vpage) {
+	uint64_t *pte = pte_lookup (pml4, vpage);
+	return pte != NULL && (*pte & PTE_PS) != 0;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 has been
  * accessed recently, that is, between the time the PTE was
  * installed and the last time it was cleared.  Returns false if
  * PML4 contains no PTE for VPAGE. */
 bool
 pml4_is_accessed (uint64_t *pml4, const void *vpage) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = pte_lookup (pml4, vpage);
 	return pte != NULL && (*pte & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD, or in the PDE if VPAGE is in a huge page. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = pte_lookup (pml4, vpage);
 	if (pte) {
 		if (accessed)
 			*pte |= PTE_A;
 		else
-			*pte &= ~(uint32_t) PTE_A;
+			*pte &= ~(uint64_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		pml4_invalidate (pml4, vpage);
 	}
 }
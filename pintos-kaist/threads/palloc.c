@@ -8,7 +8,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/memtrack.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -24,13 +26,29 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   The boundary between the pools is elastic, though.  When one
+   pool runs dry, its requests are served from the other pool as
+   long as the other pool keeps at least its reserve watermark of
+   free pages; such pages are "lent" and go back to their home
+   pool when freed.  If the kernel pool drops below its reserve
+   while some of its pages are lent to the user pool, the
+   registered reclaim hook (the VM's eviction path) is asked to
+   give them back. */
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
+	struct bitmap *lent_map;        /* Pages lent to the other pool. */
 	uint8_t *base;                  /* Base of pool. */
+	const char *name;               /* Name, for statistics. */
+
+	size_t free_cnt;                /* Number of free pages. */
+	size_t lent_cnt;                /* Pages lent to the other pool. */
+	size_t reserve;                 /* Free pages never lent out. */
+	size_t low_free;                /* Low-water mark of free_cnt. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -38,10 +56,25 @@ static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* Number of kernel pages that are never lent to the user pool.
+   SIZE_MAX selects the default of a quarter of the kernel pool. */
+size_t kernel_page_reserve = SIZE_MAX;
+
+/* Called when the kernel pool needs its lent pages back. */
+static palloc_reclaim_func *reclaim_hook;
+
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static size_t pool_alloc_aligned (struct pool *, size_t page_cnt);
+static size_t pool_alloc (struct pool *, size_t page_cnt, size_t reserve,
+		bool lend);
+static void *get_multiple (enum palloc_flags, size_t page_cnt);
+static void free_multiple (void *, size_t page_cnt);
+static struct pool *page_pool (void *page);
+static void pool_free (struct pool *, void *pages, size_t page_cnt);
 
 /* multiboot info */
 struct multiboot_info {
@@ -189,6 +222,8 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 
 	// generate the user pool
 	init_pool(&user_pool, &free_start, region_start, end);
+	kernel_pool.name = "kernel";
+	user_pool.name = "user";
 
 	// Iterate over the e820_entry. Setup the usable.
 	uint64_t usable_bound = (uint64_t) free_start;
@@ -232,6 +267,21 @@ split:
 			}
 		}
 	}
+
+	// Count the free pages and set up the watermarks.
+	kernel_pool.free_cnt = bitmap_count (kernel_pool.used_map, 0,
+			bitmap_size (kernel_pool.used_map), false);
+	user_pool.free_cnt = bitmap_count (user_pool.used_map, 0,
+			bitmap_size (user_pool.used_map), false);
+	kernel_pool.low_free = kernel_pool.free_cnt;
+	user_pool.low_free = user_pool.free_cnt;
+
+	kernel_pool.reserve = kernel_page_reserve != SIZE_MAX ?
+		kernel_page_reserve : kernel_pool.free_cnt / 4;
+	// An explicit -ul caps the user pool, so it must not grow.
+	user_pool.reserve = user_pool.free_cnt / 2;
+	if (user_page_limit != SIZE_MAX)
+		kernel_pool.reserve = SIZE_MAX;
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -255,19 +305,42 @@ palloc_init (void) {
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   otherwise from the kernel pool.  If that pool is exhausted, the
+   pages are borrowed from the other pool, provided it stays above
+   its reserve watermark.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
-	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	void *pages = get_multiple (flags, page_cnt);
+	memtrack_alloc (MEMTRACK_PALLOC, MEMTRACK_SITE (), pages,
+			page_cnt * PGSIZE);
+	return pages;
+}
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+/* Does the work of palloc_get_multiple(), without recording the
+   allocation. */
+static void *
+get_multiple (enum palloc_flags flags, size_t page_cnt) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	struct pool *other = flags & PAL_USER ? &kernel_pool : &user_pool;
+	size_t page_idx = pool_alloc (pool, page_cnt, 0, false);
 	void *pages;
 
+	if (page_idx == BITMAP_ERROR) {
+		page_idx = pool_alloc (other, page_cnt, other->reserve, true);
+		pool = other;
+	}
+	if (page_idx == BITMAP_ERROR && !(flags & PAL_USER)
+			&& reclaim_hook != NULL && kernel_pool.lent_cnt > 0) {
+		/* Out of kernel pages while some are lent to the user
+		   pool: have them evicted and try again. */
+		reclaim_hook (page_cnt);
+		pool = &kernel_pool;
+		page_idx = pool_alloc (pool, page_cnt, 0, false);
+	}
+
 	if (page_idx != BITMAP_ERROR)
 		pages = pool->base + PGSIZE * page_idx;
 	else
@@ -293,58 +366,245 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_page (enum palloc_flags flags) {
-	return palloc_get_multiple (flags, 1);
+	void *page = get_multiple (flags, 1);
+	memtrack_alloc (MEMTRACK_PALLOC, MEMTRACK_SITE (), page, PGSIZE);
+	return page;
+}
+
+/* Obtains PAGE_CNT contiguous free pages, PAGE_CNT a power of 2,
+   whose physical address is a multiple of PAGE_CNT pages, and
+   returns the kernel virtual address of the first one.  The pages
+   come from the pool selected by FLAGS, never borrowed from the
+   other one, and are zeroed if PAL_ZERO is set.  Each page is a
+   separate allocation, to be freed with palloc_free_page().
+   Returns a null pointer if there is no such run of free pages. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx = pool_alloc_aligned (pool, page_cnt);
+	uint8_t *pages;
+
+	if (page_idx == BITMAP_ERROR)
+		return NULL;
+	pages = pool->base + PGSIZE * page_idx;
+	if (flags & PAL_ZERO)
+		memset (pages, 0, PGSIZE * page_cnt);
+	for (size_t i = 0; i < page_cnt; i++)
+		memtrack_alloc (MEMTRACK_PALLOC, MEMTRACK_SITE (), pages + i * PGSIZE,
+				PGSIZE);
+	return pages;
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
+	memtrack_free (MEMTRACK_PALLOC, pages);
+	free_multiple (pages, page_cnt);
+}
+
+/* Does the work of palloc_free_multiple(). */
+static void
+free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
-	size_t page_idx;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
 		return;
 
-	if (page_from_pool (&kernel_pool, pages))
-		pool = &kernel_pool;
-	else if (page_from_pool (&user_pool, pages))
-		pool = &user_pool;
-	else
-		NOT_REACHED ();
-
-	page_idx = pg_no (pages) - pg_no (pool->base);
-
+	pool = page_pool (pages);
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
-	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	/* This may run with interrupts off from the scheduler, so we
+	   cannot take POOL's lock.  Disabling interrupts keeps the
+	   counters consistent with pool_alloc(). */
+	enum intr_level old_level = intr_disable ();
+	pool_free (pool, pages, page_cnt);
+	intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
 void
 palloc_free_page (void *page) {
-	palloc_free_multiple (page, 1);
+	memtrack_free (MEMTRACK_PALLOC, page);
+	free_multiple (page, 1);
+}
+
+/* Frees the PAGE_CNT pages in PAGES, each a separate allocation
+   from either pool, turning interrupts off only once for all of
+   them. */
+void
+palloc_free_batch (void *pages[], size_t page_cnt) {
+	enum intr_level old_level;
+	size_t i;
+
+	for (i = 0; i < page_cnt; i++) {
+		ASSERT (pg_ofs (pages[i]) == 0);
+		memtrack_free (MEMTRACK_PALLOC, pages[i]);
+#ifndef NDEBUG
+		memset (pages[i], 0xcc, PGSIZE);
+#endif
+	}
+	old_level = intr_disable ();
+	for (i = 0; i < page_cnt; i++)
+		pool_free (page_pool (pages[i]), pages[i], 1);
+	intr_set_level (old_level);
+}
+
+/* Returns true if PAGE belongs to the kernel pool but is lent
+   to the user pool, false otherwise.  The reclaim hook uses this
+   to find the frames it should evict. */
+bool
+palloc_is_lent (void *page) {
+	size_t page_idx;
+
+	if (kernel_pool.lent_cnt == 0 || !page_from_pool (&kernel_pool, page))
+		return false;
+	page_idx = pg_no (page) - pg_no (kernel_pool.base);
+	return bitmap_test (kernel_pool.lent_map, page_idx);
+}
+
+/* Registers HOOK to be called when the kernel pool runs out of
+   pages while some of them are lent to the user pool. */
+void
+palloc_set_reclaim_hook (palloc_reclaim_func *hook) {
+	reclaim_hook = hook;
+}
+
+/* Returns the number of free pages in the pool selected by
+   FLAGS (PAL_USER or not). */
+size_t
+palloc_free_cnt (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return pool->free_cnt;
+}
+
+/* Prints per-pool usage and watermark statistics. */
+void
+palloc_print_stats (void) {
+	struct pool *pools[] = { &kernel_pool, &user_pool };
+
+	for (size_t i = 0; i < sizeof pools / sizeof *pools; i++) {
+		struct pool *p = pools[i];
+		size_t size = bitmap_size (p->used_map);
+
+		if (p->reserve == SIZE_MAX)
+			printf ("Palloc: %s pool: %zu/%zu pages used (min free %zu), "
+					"not lending, %zu lent\n", p->name, size - p->free_cnt,
+					size, p->low_free, p->lent_cnt);
+		else
+			printf ("Palloc: %s pool: %zu/%zu pages used (min free %zu), "
+					"reserve %zu, %zu lent\n", p->name, size - p->free_cnt,
+					size, p->low_free, p->reserve, p->lent_cnt);
+	}
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first one, or BITMAP_ERROR if that would leave
+   fewer than RESERVE free pages.  If LEND is true, the pages are
+   recorded as lent to the other pool. */
+static size_t
+pool_alloc (struct pool *pool, size_t page_cnt, size_t reserve, bool lend) {
+	size_t page_idx = BITMAP_ERROR;
+
+	if (reserve == SIZE_MAX)
+		return BITMAP_ERROR;
+
+	lock_acquire (&pool->lock);
+	if (pool->free_cnt >= page_cnt && pool->free_cnt - page_cnt >= reserve) {
+		enum intr_level old_level = intr_disable ();
+		page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+		if (page_idx != BITMAP_ERROR) {
+			pool->free_cnt -= page_cnt;
+			if (pool->free_cnt < pool->low_free)
+				pool->low_free = pool->free_cnt;
+			if (lend) {
+				bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, true);
+				pool->lent_cnt += page_cnt;
+			}
+		}
+		intr_set_level (old_level);
+	}
+	lock_release (&pool->lock);
+	return page_idx;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL that start at a
+   physical page number divisible by PAGE_CNT, and returns the
+   index of the first one, or BITMAP_ERROR if there are none. */
+static size_t
+pool_alloc_aligned (struct pool *pool, size_t page_cnt) {
+	size_t size = bitmap_size (pool->used_map);
+	size_t page_idx = BITMAP_ERROR;
+	size_t i;
+
+	ASSERT (page_cnt > 0 && (page_cnt & (page_cnt - 1)) == 0);
+
+	lock_acquire (&pool->lock);
+	if (pool->free_cnt >= page_cnt) {
+		enum intr_level old_level = intr_disable ();
+		for (i = -pg_no (pool->base) & (page_cnt - 1); i + page_cnt <= size;
+				i += page_cnt)
+			if (!bitmap_any (pool->used_map, i, page_cnt)) {
+				bitmap_set_multiple (pool->used_map, i, page_cnt, true);
+				pool->free_cnt -= page_cnt;
+				if (pool->free_cnt < pool->low_free)
+					pool->low_free = pool->free_cnt;
+				page_idx = i;
+				break;
+			}
+		intr_set_level (old_level);
+	}
+	lock_release (&pool->lock);
+	return page_idx;
 }
 
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and lent_map at its base.
+     Calculate the space needed for the bitmaps
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
 
 	lock_init(&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->lent_map = bitmap_create_in_buf (pgcnt, *bm_base + bm_pages, bm_pages);
 	p->base = (void *) start;
 
-	// Mark all to unusable.
+	// Mark all to unusable, and nothing lent.
 	bitmap_set_all(p->used_map, true);
+	bitmap_set_all(p->lent_map, false);
 
-	*bm_base += bm_pages;
+	*bm_base += 2 * bm_pages;
+}
+
+/* Returns the pool that PAGE belongs to. */
+static struct pool *
+page_pool (void *page) {
+	if (page_from_pool (&kernel_pool, page))
+		return &kernel_pool;
+	else if (page_from_pool (&user_pool, page))
+		return &user_pool;
+	NOT_REACHED ();
+}
+
+/* Marks the PAGE_CNT pages starting at PAGES free in POOL.
+   Interrupts must be off. */
+static void
+pool_free (struct pool *pool, void *pages, size_t page_cnt) {
+	size_t page_idx = pg_no (pages) - pg_no (pool->base);
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+
+	if (pool->lent_cnt > 0 && bitmap_any (pool->lent_map, page_idx, page_cnt)) {
+		pool->lent_cnt -= bitmap_count (pool->lent_map, page_idx, page_cnt, true);
+		bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, false);
+	}
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool->free_cnt += page_cnt;
 }
 
 /* Returns true if PAGE was allocated from POOL,
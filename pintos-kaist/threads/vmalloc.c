@@ -0,0 +1,214 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+
+/* Virtually contiguous allocator.
+
+   The reserved range [VMALLOC_START, VMALLOC_END) is managed by
+   a bitmap with one bit per virtual page.  Each allocation takes
+   its pages plus one unmapped guard page, so that running off
+   the end of a buffer faults instead of corrupting the next one.
+   The page tables for the range hang off base_pml4's PML4 entry
+   for the kernel, which every process page map shares, so a
+   mapping made here is visible in every address space.
+
+   Freeing is lazy about the TLB.  vfree() clears the PTEs and
+   returns the pages right away, but keeps the virtual range
+   reserved on a purge list.  Once enough ranges pile up, or when
+   the range runs out, one full TLB flush makes all of them safe
+   to reuse at once instead of one invlpg per freed page. */
+
+#define VMALLOC_PAGES (VMALLOC_SIZE / PGSIZE)
+
+/* Freed pages we let pile up before flushing the TLB. */
+#define LAZY_MAX_PAGES 1024
+
+/* One allocated or lazily freed range. */
+struct vmap_area {
+	struct list_elem elem;      /* Element in busy_list or purge_list. */
+	uint8_t *addr;              /* First virtual page. */
+	size_t page_cnt;            /* Mapped pages, without the guard page. */
+};
+
+static struct lock vmalloc_lock;
+static struct bitmap *va_map;   /* Reserved virtual pages. */
+static struct list busy_list;   /* Live allocations. */
+static struct list purge_list;  /* Freed, waiting for a TLB flush. */
+static size_t lazy_pages;       /* Pages on purge_list. */
+
+/* Statistics. */
+static size_t mapped_pages;     /* Pages currently mapped. */
+static size_t peak_pages;       /* Maximum of mapped_pages. */
+static long long purge_cnt;     /* Number of TLB flushes. */
+
+static void purge_lazy_areas (void);
+static void unmap_area (struct vmap_area *);
+
+/* Initializes the virtually contiguous allocator. */
+void
+vmalloc_init (void) {
+	lock_init (&vmalloc_lock);
+	list_init (&busy_list);
+	list_init (&purge_list);
+	va_map = bitmap_create (VMALLOC_PAGES);
+	if (va_map == NULL)
+		PANIC ("vmalloc: cannot allocate the address map");
+}
+
+/* Obtains and returns a new block of at least SIZE bytes that is
+   contiguous in kernel virtual memory.  The pages behind it are
+   allocated one by one from the kernel pool.  Returns a null
+   pointer if memory or address space is not available. */
+void *
+vmalloc (size_t size) {
+	struct vmap_area *area;
+	size_t page_cnt, idx, i;
+
+	if (size == 0)
+		return NULL;
+	page_cnt = DIV_ROUND_UP (size, PGSIZE);
+
+	area = malloc (sizeof *area);
+	if (area == NULL)
+		return NULL;
+
+	lock_acquire (&vmalloc_lock);
+	idx = bitmap_scan_and_flip (va_map, 0, page_cnt + 1, false);
+	if (idx == BITMAP_ERROR && lazy_pages > 0) {
+		purge_lazy_areas ();
+		idx = bitmap_scan_and_flip (va_map, 0, page_cnt + 1, false);
+	}
+	if (idx == BITMAP_ERROR) {
+		lock_release (&vmalloc_lock);
+		free (area);
+		return NULL;
+	}
+	area->addr = (uint8_t *) VMALLOC_START + idx * PGSIZE;
+	area->page_cnt = 0;
+
+	for (i = 0; i < page_cnt; i++) {
+		uint64_t va = (uint64_t) area->addr + i * PGSIZE;
+		void *kpage = palloc_get_page (0);
+		uint64_t *pte;
+
+		if (kpage == NULL
+				|| (pte = pml4e_walk (base_pml4, va, 1)) == NULL) {
+			palloc_free_page (kpage);
+			unmap_area (area);
+			bitmap_set_multiple (va_map, idx, page_cnt + 1, false);
+			lock_release (&vmalloc_lock);
+			free (area);
+			return NULL;
+		}
+		*pte = vtop (kpage) | PTE_P | PTE_W | PTE_G;
+		area->page_cnt++;
+	}
+
+	list_push_back (&busy_list, &area->elem);
+	mapped_pages += page_cnt;
+	if (mapped_pages > peak_pages)
+		peak_pages = mapped_pages;
+	lock_release (&vmalloc_lock);
+
+	return area->addr;
+}
+
+/* Allocates and returns CNT times SIZE bytes from vmalloc(),
+   initialized to zeroes.  Returns a null pointer if memory is
+   not available. */
+void *
+vcalloc (size_t cnt, size_t size) {
+	size_t total = cnt * size;
+	void *p;
+
+	if (size != 0 && total / size != cnt)
+		return NULL;
+
+	p = vmalloc (total);
+	if (p != NULL)
+		memset (p, 0, total);
+	return p;
+}
+
+/* Frees block P, which must have been allocated with vmalloc()
+   or vcalloc().  The pages go back to the page allocator now;
+   the virtual range is reused only after the next TLB flush. */
+void
+vfree (void *p) {
+	struct list_elem *e;
+
+	if (p == NULL)
+		return;
+	ASSERT (is_vmalloc_vaddr (p));
+
+	lock_acquire (&vmalloc_lock);
+	for (e = list_begin (&busy_list); e != list_end (&busy_list);
+			e = list_next (e)) {
+		struct vmap_area *area = list_entry (e, struct vmap_area, elem);
+		if (area->addr == p) {
+			list_remove (&area->elem);
+			mapped_pages -= area->page_cnt;
+			unmap_area (area);
+			list_push_back (&purge_list, &area->elem);
+			lazy_pages += area->page_cnt + 1;
+			if (lazy_pages > LAZY_MAX_PAGES)
+				purge_lazy_areas ();
+			lock_release (&vmalloc_lock);
+			return;
+		}
+	}
+	PANIC ("vfree: %p was not allocated with vmalloc", p);
+}
+
+/* Prints statistics about vmalloc usage. */
+void
+vmalloc_print_stats (void) {
+	printf ("Vmalloc: %zu pages mapped (peak %zu), %zu lazily freed, "
+			"%lld TLB flushes\n", mapped_pages, peak_pages, lazy_pages,
+			purge_cnt);
+}
+
+/* Clears the PTEs of AREA's mapped pages and frees the pages.
+   The stale TLB entries are left for purge_lazy_areas(). */
+static void
+unmap_area (struct vmap_area *area) {
+	for (size_t i = 0; i < area->page_cnt; i++) {
+		uint64_t va = (uint64_t) area->addr + i * PGSIZE;
+		uint64_t *pte = pml4e_walk (base_pml4, va, 0);
+
+		ASSERT (pte != NULL && (*pte & PTE_P));
+		palloc_free_page (ptov (PTE_ADDR (*pte)));
+		*pte = 0;
+	}
+}
+
+/* Flushes the whole TLB once and releases the virtual ranges of
+   every area on the purge list.  Kernel mappings are global and
+   may be cached under every PCID, so reloading CR3 would not drop
+   them: tlb_flush_all() flushes the global entries too. */
+static void
+purge_lazy_areas (void) {
+	ASSERT (lock_held_by_current_thread (&vmalloc_lock));
+
+	tlb_flush_all ();
+	purge_cnt++;
+	while (!list_empty (&purge_list)) {
+		struct vmap_area *area =
+			list_entry (list_pop_front (&purge_list), struct vmap_area, elem);
+		size_t idx = ((uint64_t) area->addr - VMALLOC_START) / PGSIZE;
+		bitmap_set_multiple (va_map, idx, area->page_cnt + 1, false);
+		free (area);
+	}
+	lazy_pages = 0;
+}
@@ -0,0 +1,129 @@
+#include "userprog/cow.h"
+#ifndef VM
+#include <debug.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+#include "intrinsic.h"
+
+/* Copy-on-write sharing of user pages.
+
+   fork() maps each of the parent's pages into the child instead
+   of copying it.  A page that was writable loses PTE_W in both
+   page maps and gets PTE_COW instead.  The first write to it
+   faults, and cow_handle_fault() gives the writer its own copy,
+   or, if no one else maps the page any more, just makes it
+   writable again.
+
+   share_cnt[] counts, for each physical page, the page maps that
+   map it besides the first one.  A process that exits drops its
+   references with cow_release() before its page map is destroyed,
+   so that pml4_destroy() frees only the pages nobody else maps. */
+
+static uint16_t *share_cnt;     /* Extra mappings, by page number. */
+static struct lock cow_lock;
+
+/* Initializes copy-on-write sharing. */
+void
+cow_init (void) {
+	lock_init (&cow_lock);
+	share_cnt = vcalloc (ram_pages, sizeof *share_cnt);
+	if (share_cnt == NULL)
+		PANIC ("cow: cannot allocate the share counts");
+}
+
+/* Returns the index in share_cnt[] of the page that PTE maps. */
+static inline size_t
+page_idx (uint64_t *pte) {
+	return PTE_ADDR (*pte) / PGSIZE;
+}
+
+/* Maps the page that PTE, in the parent's page map PML4, maps at
+ * VA into CHILD_PML4 too.  If the page is writable, write-protects
+ * it in both page maps.  Returns true if successful, false if
+ * memory is not available. */
+bool
+cow_share_page (uint64_t *pml4, uint64_t *pte, uint64_t *child_pml4,
+		void *va) {
+	void *kpage = ptov (PTE_ADDR (*pte));
+	bool cow = is_writable (pte) || (*pte & PTE_COW);
+	uint64_t *child_pte;
+
+	if (!pml4_set_page (child_pml4, va, kpage, false))
+		return false;
+
+	lock_acquire (&cow_lock);
+	ASSERT (share_cnt[page_idx (pte)] < UINT16_MAX);
+	share_cnt[page_idx (pte)]++;
+	if (cow) {
+		*pte = (*pte & ~(uint64_t) PTE_W) | PTE_COW;
+		child_pte = pml4e_walk (child_pml4, (uint64_t) va, 0);
+		*child_pte |= PTE_COW;
+	}
+	lock_release (&cow_lock);
+	if (cow)
+		pml4_invalidate (pml4, va);
+	return true;
+}
+
+/* Resolves a write fault at ADDR in PML4 if it hit a copy-on-write
+ * page.  Returns true if the access can be retried, false if it
+ * was not a copy-on-write fault or memory is not available. */
+bool
+cow_handle_fault (uint64_t *pml4, void *addr) {
+	void *upage = pg_round_down (addr);
+	uint64_t *pte;
+	bool success = true;
+
+	if (pml4 == NULL || !is_user_vaddr (addr))
+		return false;
+	pte = pml4e_walk (pml4, (uint64_t) upage, 0);
+	if (pte == NULL || !(*pte & PTE_P) || !(*pte & PTE_COW))
+		return false;
+
+	lock_acquire (&cow_lock);
+	if (share_cnt[page_idx (pte)] == 0)
+		*pte = (*pte | PTE_W) & ~(uint64_t) PTE_COW;
+	else {
+		void *kpage = palloc_get_page (PAL_USER);
+
+		if (kpage == NULL)
+			success = false;
+		else {
+			memcpy (kpage, ptov (PTE_ADDR (*pte)), PGSIZE);
+			share_cnt[page_idx (pte)]--;
+			*pte = vtop (kpage) | PTE_P | PTE_W | PTE_U;
+		}
+	}
+	lock_release (&cow_lock);
+
+	if (success)
+		pml4_invalidate (pml4, upage);
+	return success;
+}
+
+/* pml4_for_each() helper for cow_release(). */
+static bool
+release_pte (uint64_t *pte, void *va, void *aux UNUSED) {
+	if (is_user_vaddr (va) && share_cnt[page_idx (pte)] > 0) {
+		share_cnt[page_idx (pte)]--;
+		*pte = 0;
+	}
+	return true;
+}
+
+/* Drops PML4's references to pages that other page maps still
+ * map, and unmaps them, so that pml4_destroy() leaves them alone.
+ * PML4 must not be active. */
+void
+cow_release (uint64_t *pml4) {
+	lock_acquire (&cow_lock);
+	pml4_for_each (pml4, release_pte, NULL);
+	lock_release (&cow_lock);
+}
+#endif /* VM */
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/cow.h"
 #include "userprog/gdt.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
@@ -14,12 +15,14 @@
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
 #include "intrinsic.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/frame.h"
 #endif
 
 static void process_cleanup (void);
@@ -27,6 +30,14 @@ static bool load (const char *file_name, struct intr_frame *if_);
 static void initd (void *f_name);
 static void __do_fork (void *);
 
+/* What process_fork() hands to __do_fork(). */
+struct fork_info {
+	struct thread *parent;
+	struct intr_frame *parent_if;   /* Parent's user context. */
+	struct semaphore done;          /* Upped once the child is set up. */
+	bool success;                   /* Did the child set up? */
+};
+
 /* General process initializer for initd and other process. */
 static void
 process_init (void) {
@@ -74,41 +85,41 @@ initd (void *f_name) {
 /* Clones the current process as `name`. Returns the new process's thread id, or
  * TID_ERROR if the thread cannot be created. */
 tid_t
-process_fork (const char *name, struct intr_frame *if_ UNUSED) {
+process_fork (const char *name, struct intr_frame *if_) {
+	struct fork_info info;
+	tid_t tid;
+
+	info.parent = thread_current ();
+	info.parent_if = if_;
+	sema_init (&info.done, 0);
+	info.success = false;
+
 	/* Clone current thread to new thread.*/
-	return thread_create (name,
-			PRI_DEFAULT, __do_fork, thread_current ());
+	tid = thread_create (name, PRI_DEFAULT, __do_fork, &info);
+	if (tid == TID_ERROR)
+		return TID_ERROR;
+
+	/* The child reads our context and address space, so wait until
+	 * it is done with them. */
+	sema_down (&info.done);
+	return info.success ? tid : TID_ERROR;
 }
 
 #ifndef VM
 /* Duplicate the parent's address space by passing this function to the
- * pml4_for_each. This is only for the project 2. */
+ * pml4_for_each. This is only for the project 2.
+ * Pages are not copied here: the child maps the parent's page, and
+ * writable pages become copy-on-write in both, see cow.c. */
 static bool
 duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	struct thread *current = thread_current ();
-	struct thread *parent = (struct thread *) aux;
-	void *parent_page;
-	void *newpage;
-	bool writable;
-
-	/* 1. TODO: If the parent_page is kernel page, then return immediately. */
-
-	/* 2. Resolve VA from the parent's page map level 4. */
-	parent_page = pml4_get_page (parent->pml4, va);
+	struct thread *parent = aux;
 
-	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
-	 *    TODO: NEWPAGE. */
+	/* Kernel mappings are part of every page map already. */
+	if (is_kernel_vaddr (va))
+		return true;
 
-	/* 4. TODO: Duplicate parent's page to the new page and
-	 *    TODO: check whether parent's page is writable or not (set WRITABLE
-	 *    TODO: according to the result). */
-
-	/* 5. Add new page to child's page table at address VA with WRITABLE
-	 *    permission. */
-	if (!pml4_set_page (current->pml4, va, newpage, writable)) {
-		/* 6. TODO: if fail to insert page, do error handling. */
-	}
-	return true;
+	return cow_share_page (parent->pml4, pte, current->pml4, va);
 }
 #endif
 
@@ -119,14 +130,14 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 static void
 __do_fork (void *aux) {
 	struct intr_frame if_;
-	struct thread *parent = (struct thread *) aux;
+	struct fork_info *info = aux;
+	struct thread *parent = info->parent;
 	struct thread *current = thread_current ();
-	/* TODO: somehow pass the parent_if. (i.e. process_fork()'s if_) */
-	struct intr_frame *parent_if;
-	bool succ = true;
+	struct intr_frame *parent_if = info->parent_if;
 
 	/* 1. Read the cpu context to local stack. */
 	memcpy (&if_, parent_if, sizeof (struct intr_frame));
+	if_.R.rax = 0;
 
 	/* 2. Duplicate PT */
 	current->pml4 = pml4_create();
@@ -151,10 +162,15 @@ __do_fork (void *aux) {
 
 	process_init ();
 
+	/* INFO lives on the parent's stack: do not touch it after
+	 * waking the parent up. */
+	info->success = true;
+	sema_up (&info->done);
+
 	/* Finally, switch to the newly created process. */
-	if (succ)
-		do_iret (&if_);
+	do_iret (&if_);
 error:
+	sema_up (&info->done);
 	thread_exit ();
 }
 
@@ -216,6 +232,10 @@ process_exit (void) {
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
 
+#ifdef VM
+	if (vm_exit_stats && curr->pml4 != NULL)
+		vm_print_exit_stats ();
+#endif
 	process_cleanup ();
 }
 
@@ -242,7 +262,12 @@ process_cleanup (void) {
 		 * that's been freed (and cleared). */
 		curr->pml4 = NULL;
 		pml4_activate (NULL);
+#ifdef VM
+		frame_defer_destroy (pml4);
+#else
+		cow_release (pml4);
 		pml4_destroy (pml4);
+#endif
 	}
 }
 
@@ -478,6 +503,9 @@ validate_segment (const struct Phdr *phdr, struct file *file) {
 /* load() helpers. */
 static bool install_page (void *upage, void *kpage, bool writable);
 
+/* Most pages load_segment() reads with one call. */
+#define LOAD_RUN_PAGES 16
+
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -501,35 +529,51 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
 	file_seek (file, ofs);
 	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* Get a page of memory. */
-		uint8_t *kpage = palloc_get_page (PAL_USER);
-		if (kpage == NULL)
-			return false;
-
-		/* Load this page. */
-		if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes) {
-			palloc_free_page (kpage);
-			return false;
+		/* Take the pages in runs of up to LOAD_RUN_PAGES physically
+		 * contiguous pages, so that each run is read from FILE
+		 * with a single call.  The run is a power of two that
+		 * fits in the segment, or a single page if no such run
+		 * of user pages is free. */
+		size_t page_cnt = (read_bytes + zero_bytes) / PGSIZE;
+		size_t run_pages = 1, run_read_bytes, i;
+		uint8_t *kpages;
+
+		while (run_pages * 2 <= page_cnt && run_pages * 2 <= LOAD_RUN_PAGES)
+			run_pages *= 2;
+		for (;;) {
+			kpages = run_pages > 1 ? palloc_get_aligned (PAL_USER, run_pages)
+				: palloc_get_page (PAL_USER);
+			if (kpages != NULL)
+				break;
+			if (run_pages == 1)
+				return false;
+			run_pages /= 2;
 		}
-		memset (kpage + page_read_bytes, 0, page_zero_bytes);
+		run_read_bytes = read_bytes < run_pages * PGSIZE
+			? read_bytes : run_pages * PGSIZE;
 
-		/* Add the page to the process's address space. */
-		if (!install_page (upage, kpage, writable)) {
-			printf("fail\n");
-			palloc_free_page (kpage);
+		/* Load this run. */
+		if (file_read (file, kpages, run_read_bytes) != (int) run_read_bytes) {
+			for (i = 0; i < run_pages; i++)
+				palloc_free_page (kpages + i * PGSIZE);
 			return false;
 		}
+		memset (kpages + run_read_bytes, 0,
+				run_pages * PGSIZE - run_read_bytes);
+
+		/* Add the pages to the process's address space. */
+		for (i = 0; i < run_pages; i++)
+			if (!install_page (upage + i * PGSIZE, kpages + i * PGSIZE,
+						writable)) {
+				while (i < run_pages)
+					palloc_free_page (kpages + i++ * PGSIZE);
+				return false;
+			}
 
 		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
+		read_bytes -= run_read_bytes;
+		zero_bytes -= run_pages * PGSIZE - run_read_bytes;
+		upage += run_pages * PGSIZE;
 	}
 	return true;
 }
@@ -574,13 +618,6 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
-static bool
-lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
-}
-
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -602,6 +639,14 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
+	/* The file pages of the segment share one handle on FILE, which
+	 * each of them keeps a reference to. */
+	struct file_handle *fh = NULL;
+	bool success = true;
+
+	if (read_bytes > 0 && (fh = file_handle_open (file)) == NULL)
+		return false;
+
 	while (read_bytes > 0 || zero_bytes > 0) {
 		/* Do calculate how to fill this page.
 		 * We will read PAGE_READ_BYTES bytes from FILE
@@ -609,18 +654,44 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
+		/* A page past the end of the file data, such as a page of
+		 * the BSS, needs no file handle: it is a plain lazy
+		 * anonymous page, which reads as zeros. */
+		if (page_read_bytes == 0) {
+			if (!vm_alloc_page (VM_ANON, upage, writable)) {
+				success = false;
+				break;
+			}
+			zero_bytes -= PGSIZE;
+			upage += PGSIZE;
+			continue;
+		}
+
+		struct file_load *aux = file_load_create (fh, ofs, page_read_bytes);
+		if (aux == NULL) {
+			success = false;
+			break;
+		}
+		/* Read-only pages are text, which processes running the
+		 * same program share. */
+		success = writable
+			? vm_alloc_page_with_initializer (VM_ANON, upage, true,
+					file_load_anon, aux)
+			: vm_alloc_page_with_initializer (VM_FILE | VM_TEXT, upage, false,
+					file_backed_load, aux);
+		if (!success) {
+			file_load_free (aux);
+			break;
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
+		ofs += page_read_bytes;
 	}
-	return true;
+	file_handle_put (fh);
+	return success;
 }
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
@@ -629,11 +700,12 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
+	if (vm_alloc_page (VM_ANON | VM_STACK, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		thread_current ()->spt.stack_bottom = stack_bottom;
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 	return success;
 }
 #endif /* VM */
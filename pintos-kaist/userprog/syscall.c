@@ -7,6 +7,9 @@
 #include "userprog/gdt.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
@@ -39,7 +42,22 @@ syscall_init (void) {
 
 /* The main system call interface */
 void
-syscall_handler (struct intr_frame *f UNUSED) {
+syscall_handler (struct intr_frame *f) {
+#ifdef VM
+	/* A page fault in the kernel may need to grow the stack. */
+	thread_current ()->user_rsp = f->rsp;
+#endif
+	switch (f->R.rax) {
+#ifdef VM
+		case SYS_MADVISE:
+			f->R.rax = do_madvise ((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+			return;
+		case SYS_GET_VMSTAT:
+			f->R.rax = do_get_vmstat ((struct vmstat *) f->R.rdi);
+			return;
+#endif
+	}
+
 	// TODO: Your implementation goes here.
 	printf ("system call!\n");
 	thread_exit ();
@@ -1,7 +1,11 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <string.h>
 #include "devices/disk.h"
+#include "threads/vaddr.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -20,8 +24,9 @@ static const struct page_operations anon_ops = {
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	swap_init (swap_disk);
+	zswap_init ();
 }
 
 /* Initialize the file mapping */
@@ -31,22 +36,66 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SWAP_SLOT_NONE;
+	anon_page->zentry = NULL;
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	struct vmstat *stat = &page->owner->vmstat;
+
+	if (zswap_load (anon_page, kva))
+		goto swapped_in;
+	if (anon_page->slot == SWAP_SLOT_NONE) {
+		memset (kva, 0, PGSIZE);
+		return true;
+	}
+	if (!swap_read (anon_page->slot, kva))
+		return false;
+	anon_page->slot = SWAP_SLOT_NONE;
+	anon_page->zentry = NULL;
+
+swapped_in:
+	stat->swap_pages--;
+	stat->swap_ins++;
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (!zswap_store (anon_page, page->frame->kva)) {
+		anon_page->slot = swap_write (page->frame->kva);
+		if (anon_page->slot == SWAP_SLOT_NONE)
+			return false;
+	}
+	page->owner->vmstat.swap_pages++;
+	return true;
+}
+
+/* Drops the contents of PAGE, freeing its frame and its swap
+ * slot.  Afterward the page reads as zeros. */
+void
+anon_discard (struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+
+	vm_free_frame (page);
+	if (anon_page->zentry != NULL || anon_page->slot != SWAP_SLOT_NONE)
+		page->owner->vmstat.swap_pages--;
+	zswap_invalidate (anon_page);
+	if (anon_page->slot != SWAP_SLOT_NONE) {
+		swap_free (anon_page->slot);
+		anon_page->slot = SWAP_SLOT_NONE;
+	}
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	anon_discard (page);
 }
@@ -0,0 +1,210 @@
+/* clockpro.c: CLOCK-Pro page replacement. */
+
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include "vm/frame.h"
+#include "vm/vm.h"
+
+/* CLOCK-Pro (Jiang, Chen and Zhang, USENIX ATC 2005) keeps the
+   pages that are reused at short distances hot and evicts only
+   cold pages, so that one pass over a large array cannot push
+   the working set out of memory the way it does with a single
+   clock.
+
+   The paper runs three hands over one ring.  Here each class has
+   its own ring, with its hand at the front:
+
+   - hot_list holds resident hot frames.  The hot hand demotes the
+     first frame it finds that was not accessed since its last
+     visit.
+
+   - cold_list holds resident cold frames.  A newly faulted page
+     starts cold and in its "test period".  If the cold hand finds
+     a frame accessed during its test period, the frame turns hot.
+     If the frame was accessed outside its test period, it gets a
+     new test period and another turn.  A frame that was not
+     accessed is evicted.
+
+   - test_list holds pages that were evicted during their test
+     period.  They are non-resident, and struct page carries the
+     link, so remembering them costs no memory.  If such a page
+     faults back in, it was reused within about one memory's worth
+     of other accesses: it comes back hot, and the cold target
+     grows.  A page that leaves test_list without being reused
+     shrinks the target.  The test hand keeps at most frame_cnt
+     pages on the list.
+
+   cold_target is the number of resident cold frames the hot hand
+   aims for.  It adapts between 1 and frame_cnt - 1 as described
+   above. */
+
+/* Bits in struct frame's flags. */
+#define CP_HOT 0x1                  /* Hot frame. */
+#define CP_TEST 0x2                 /* Cold frame in its test period. */
+
+static struct list hot_list;
+static struct list cold_list;
+static struct list test_list;
+static size_t hot_cnt, cold_cnt, test_cnt;
+static size_t frame_cnt;            /* Frames in the user pool. */
+static size_t cold_target;          /* Desired number of cold frames. */
+
+/* Statistics. */
+static long long promote_cnt;       /* Cold frames that turned hot. */
+static long long demote_cnt;        /* Hot frames that turned cold. */
+static long long refault_cnt;       /* Faults on pages in test_list. */
+
+static void
+clockpro_init (size_t cnt) {
+	list_init (&hot_list);
+	list_init (&cold_list);
+	list_init (&test_list);
+	frame_cnt = cnt > 2 ? cnt : 2;
+	cold_target = frame_cnt / 4 > 0 ? frame_cnt / 4 : 1;
+}
+
+/* Makes F hot. */
+static void
+make_hot (struct frame *f) {
+	f->flags = CP_HOT;
+	list_push_back (&hot_list, &f->elem);
+	hot_cnt++;
+}
+
+/* Makes F cold, in its test period if TEST is true. */
+static void
+make_cold (struct frame *f, bool test) {
+	f->flags = test ? CP_TEST : 0;
+	list_push_back (&cold_list, &f->elem);
+	cold_cnt++;
+}
+
+/* Removes PAGE from test_list. */
+static void
+end_test (struct page *page) {
+	list_remove (&page->test_elem);
+	page->in_test = false;
+	test_cnt--;
+}
+
+/* Runs the hot hand until it demotes one frame. */
+static void
+run_hand_hot (void) {
+	while (!list_empty (&hot_list)) {
+		struct frame *f =
+			list_entry (list_pop_front (&hot_list), struct frame, elem);
+		hot_cnt--;
+		if (frame_test_and_clear_accessed (f))
+			make_hot (f);
+		else {
+			make_cold (f, false);
+			demote_cnt++;
+			return;
+		}
+	}
+}
+
+/* Runs the test hand: ends the test periods of the oldest
+   non-resident pages until at most frame_cnt are left. */
+static void
+run_hand_test (void) {
+	while (test_cnt > frame_cnt) {
+		struct page *page =
+			list_entry (list_front (&test_list), struct page, test_elem);
+		end_test (page);
+		if (cold_target > 1)
+			cold_target--;
+	}
+}
+
+static void
+clockpro_insert (struct frame *f) {
+	struct page *page = f->page;
+
+	if (page->in_test) {
+		/* Reused during its test period: its reuse distance
+		 * fits in memory. */
+		end_test (page);
+		refault_cnt++;
+		if (cold_target < frame_cnt - 1)
+			cold_target++;
+		make_hot (f);
+	} else
+		make_cold (f, true);
+}
+
+static void
+clockpro_remove (struct frame *f) {
+	list_remove (&f->elem);
+	if (f->flags & CP_HOT)
+		hot_cnt--;
+	else
+		cold_cnt--;
+}
+
+static struct frame *
+clockpro_victim (void) {
+	for (;;) {
+		struct frame *f;
+
+		if (list_empty (&cold_list) || hot_cnt + cold_target > frame_cnt)
+			run_hand_hot ();
+		if (list_empty (&cold_list))
+			return NULL;
+
+		f = list_entry (list_pop_front (&cold_list), struct frame, elem);
+		cold_cnt--;
+		if (frame_test_and_clear_accessed (f)) {
+			if (f->flags & CP_TEST) {
+				make_hot (f);
+				promote_cnt++;
+			} else
+				make_cold (f, true);
+			continue;
+		}
+
+		if (f->flags & CP_TEST) {
+			f->page->in_test = true;
+			list_push_back (&test_list, &f->page->test_elem);
+			test_cnt++;
+			run_hand_test ();
+		}
+		return f;
+	}
+}
+
+/* F was chosen as the victim but some of its pages could not be
+   written out.  Those pages stay resident, so they are not in a
+   test period; the table is about to insert F again. */
+static void
+clockpro_restore (struct frame *f) {
+	for (struct page *page = f->page; page != NULL; page = page->share_next)
+		if (page->in_test)
+			end_test (page);
+}
+
+static void
+clockpro_forget (struct page *page) {
+	if (page->in_test)
+		end_test (page);
+}
+
+static void
+clockpro_print_stats (void) {
+	printf ("CLOCK-Pro: %zu hot, %zu cold (target %zu), %zu in test, "
+			"%lld promoted, %lld demoted, %lld test refaults\n",
+			hot_cnt, cold_cnt, cold_target, test_cnt, promote_cnt, demote_cnt,
+			refault_cnt);
+}
+
+const struct frame_policy clockpro_policy = {
+	.name = "clockpro",
+	.init = clockpro_init,
+	.insert = clockpro_insert,
+	.remove = clockpro_remove,
+	.victim = clockpro_victim,
+	.restore = clockpro_restore,
+	.forget = clockpro_forget,
+	.print_stats = clockpro_print_stats,
+};
@@ -1,10 +1,24 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
+#include "vm/frame.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
+static void readahead_thread (void *aux);
+static void text_cache_init (void);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations file_ops = {
@@ -14,9 +28,54 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Readahead.
+
+   The readahead state of a mapping follows its faults.  A fault
+   is sequential if it lands between the end of the run of pages
+   that the previous fault left resident and the end of what was
+   read ahead: then the readahead window grows, starting from
+   RA_MIN_PAGES and doubling up to RA_MAX_PAGES, and the pages up
+   to a window past the resident run are queued for the
+   readahead thread.  Any other fault is random: it drops the
+   window to 0, and nothing is read ahead until the mapping is
+   scanned in order again.
+
+   The faulting thread loads only its own page, or its
+   fault-around run, and returns to user space.  The readahead
+   thread loads the queued pages in the background, one page per
+   hold of the frame table lock and only into free frames,
+   taking turns among the mappings in its queue.  A mapping that
+   is being removed first leaves the queue and waits out the page
+   the thread may be loading for it.
+
+   madvise() overrides the heuristic for a whole mapping:
+   MADV_SEQUENTIAL treats every fault as sequential, with the
+   largest window from the start, and MADV_RANDOM never reads
+   ahead.  MADV_WILLNEED queues the given pages for the readahead
+   thread at once. */
+
+#define RA_MIN_PAGES 4
+#define RA_MAX_PAGES 64
+
+static struct lock ra_lock;
+static struct list ra_queue;        /* Mappings with pages to load. */
+static struct condition ra_work;    /* Signaled when ra_queue grows. */
+static struct condition ra_idle;    /* Signaled when a load is done. */
+
+/* Statistics. */
+static long long seq_fault_cnt;     /* Sequential faults. */
+static long long random_fault_cnt;  /* Random faults. */
+static long long ra_page_cnt;       /* Pages loaded ahead. */
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	lock_init (&ra_lock);
+	list_init (&ra_queue);
+	cond_init (&ra_work);
+	cond_init (&ra_idle);
+	text_cache_init ();
+	thread_create ("readahead", PRI_DEFAULT, readahead_thread, NULL);
 }
 
 /* Initialize the file backed page */
@@ -26,33 +85,632 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	file_page->fh = NULL;
+	file_page->text = (type & VM_TEXT) != 0;
+	return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (file_read_at (file_page->fh->file, kva, file_page->read_bytes,
+				file_page->ofs) != (off_t) file_page->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return true;
+}
+
+/* Writes PAGE, which has a frame, back to its file if it is
+ * dirty.  Returns false on a short write. */
+static bool
+file_backed_write_back (struct page *page) {
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (pml4 == NULL || !pml4_is_dirty (pml4, page->va))
+		return true;
+	if (file_write_at (file_page->fh->file, page->frame->kva,
+				file_page->read_bytes, file_page->ofs)
+			!= (off_t) file_page->read_bytes)
+		return false;
+	pml4_set_dirty (pml4, page->va, false);
+	return true;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	return file_backed_write_back (page);
+}
+
+/* Writes PAGE back if it is dirty and frees its frame.  Its next
+ * fault reads it from the file again. */
+void
+file_backed_discard (struct page *page) {
+	frame_lock_acquire ();
+	frame_wait_io (page);
+	if (page->frame != NULL)
+		file_backed_write_back (page);
+	frame_lock_release ();
+	vm_free_frame (page);
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	file_backed_discard (page);
+	file_handle_put (file_page->fh);
+}
+
+/* Loads a file-backed page on its first fault.  AUX is the
+ * page's struct file_load, whose file reference the page takes
+ * over. */
+bool
+file_backed_load (struct page *page, void *aux) {
+	struct file_load *load = aux;
+	struct file_page *file_page = &page->file;
+	bool success = file_load_read (load, page->frame->kva);
+
+	file_page->fh = load->fh;
+	file_page->ofs = load->ofs;
+	file_page->read_bytes = load->read_bytes;
+	free (load);
+	return success;
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct mmap_region *region;
+	size_t page_cnt, i;
+	off_t file_len;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || offset < 0
+			|| offset % PGSIZE != 0 || length == 0)
+		return NULL;
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	if (!is_user_vaddr (addr)
+			|| page_cnt > (KERN_BASE - (uint64_t) addr) / PGSIZE)
+		return NULL;
+	file_len = file_length (file);
+	if (file_len == 0)
+		return NULL;
+	for (i = 0; i < page_cnt; i++)
+		if (spt_find_page (spt, (uint8_t *) addr + i * PGSIZE) != NULL)
+			return NULL;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	region->fh = file_handle_open (file);
+	if (region->fh == NULL) {
+		free (region);
+		return NULL;
+	}
+	region->spt = spt;
+	region->addr = addr;
+	region->page_cnt = page_cnt;
+	region->ra_next = region->ra_end = addr;
+	region->ra_window = 0;
+	region->ra_pos = region->ra_limit = addr;
+	region->ra_queued = region->ra_busy = false;
+	region->advice = MADV_NORMAL;
+
+	for (i = 0; i < page_cnt; i++) {
+		off_t ofs = offset + i * PGSIZE;
+		size_t read_bytes = ofs >= file_len ? 0
+			: file_len - ofs < PGSIZE ? file_len - ofs : PGSIZE;
+		struct file_load *load = file_load_create (region->fh, ofs,
+				read_bytes);
+
+		if (load == NULL
+				|| !vm_alloc_page_with_initializer (VM_FILE,
+					(uint8_t *) addr + i * PGSIZE, writable, file_backed_load, load)) {
+			file_load_free (load);
+			while (i-- > 0)
+				spt_remove_page (spt,
+						spt_find_page (spt, (uint8_t *) addr + i * PGSIZE));
+			file_handle_put (region->fh);
+			free (region);
+			return NULL;
+		}
+	}
+	list_push_back (&spt->mmap_list, &region->elem);
+	return addr;
+}
+
+/* Does mmap() with FLAGS.  With MAP_POPULATE, loads the whole
+ * mapping before returning, so that its first pass takes no page
+ * faults. */
+void *
+do_mmap_flags (void *addr, size_t length, int writable,
+		struct file *file, off_t offset, int flags) {
+	if ((flags & ~MAP_POPULATE) != 0
+			|| do_mmap (addr, length, writable, file, offset) == NULL)
+		return NULL;
+	if (flags & MAP_POPULATE)
+		vm_populate (addr, (uint8_t *) addr + ROUND_UP (length, PGSIZE));
+	return addr;
+}
+
+/* Removes REGION from SPT, writing its dirty pages back. */
+void
+mmap_region_remove (struct supplemental_page_table *spt,
+		struct mmap_region *region) {
+	lock_acquire (&ra_lock);
+	if (region->ra_queued) {
+		list_remove (&region->ra_elem);
+		region->ra_queued = false;
+	}
+	while (region->ra_busy)
+		cond_wait (&ra_idle, &ra_lock);
+	lock_release (&ra_lock);
+
+	for (size_t i = 0; i < region->page_cnt; i++) {
+		struct page *page =
+			spt_find_page (spt, (uint8_t *) region->addr + i * PGSIZE);
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
+	list_remove (&region->elem);
+	file_handle_put (region->fh);
+	free (region);
+}
+
+/* Returns the mapping in SPT that contains VA, or a null
+ * pointer. */
+static struct mmap_region *
+mmap_region_find (struct supplemental_page_table *spt, void *va) {
+	struct list_elem *e;
+
+	for (e = list_begin (&spt->mmap_list); e != list_end (&spt->mmap_list);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		if ((uint8_t *) va >= (uint8_t *) region->addr
+				&& (uint8_t *) va < (uint8_t *) region->addr
+				+ region->page_cnt * PGSIZE)
+			return region;
+	}
+	return NULL;
+}
+
+/* Updates the readahead state of the mapping that holds PAGE,
+ * which the current thread just faulted in, and queues pages to
+ * read ahead if the faults are sequential. */
+void
+mmap_readahead (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	struct mmap_region *region = mmap_region_find (spt, page->va);
+	uint8_t *va = page->va, *next, *region_end, *start, *end;
+	struct page *p;
+
+	if (region == NULL)
+		return;
+	region_end = (uint8_t *) region->addr + region->page_cnt * PGSIZE;
+
+	/* Skip the run of resident pages that starts at VA. */
+	next = va + PGSIZE;
+	while (next < region_end && next < va + RA_MAX_PAGES * PGSIZE
+			&& (p = spt_find_page (spt, next)) != NULL && p->frame != NULL)
+		next += PGSIZE;
+
+	lock_acquire (&ra_lock);
+	if (region->advice == MADV_RANDOM
+			|| (region->advice != MADV_SEQUENTIAL
+				&& (va < region->ra_next || va > region->ra_end))) {
+		random_fault_cnt++;
+		region->ra_window = 0;
+		region->ra_next = region->ra_end = next;
+		lock_release (&ra_lock);
+		return;
+	}
+
+	seq_fault_cnt++;
+	if (region->advice == MADV_SEQUENTIAL)
+		region->ra_window = RA_MAX_PAGES;
+	else if (region->ra_window == 0)
+		region->ra_window = RA_MIN_PAGES;
+	else if (region->ra_window < RA_MAX_PAGES)
+		region->ra_window *= 2;
+	start = next > region->ra_end ? next : region->ra_end;
+	end = next + region->ra_window * PGSIZE;
+	if (end > region_end)
+		end = region_end;
+	region->ra_next = next;
+	if (start < end) {
+		if (!region->ra_queued || region->ra_pos >= region->ra_limit)
+			region->ra_pos = start;
+		region->ra_limit = end;
+		region->ra_end = end;
+		if (!region->ra_queued) {
+			list_push_back (&ra_queue, &region->ra_elem);
+			region->ra_queued = true;
+			cond_signal (&ra_work, &ra_lock);
+		}
+	} else if (region->ra_end < next)
+		region->ra_end = next;
+	lock_release (&ra_lock);
+}
+
+/* Applies ADVICE to the mappings in SPT that overlap [START, END).
+ * MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL apply to the whole
+ * of each mapping.  MADV_WILLNEED queues the pages of the range
+ * for the readahead thread. */
+void
+mmap_advise (struct supplemental_page_table *spt, void *start, void *end,
+		int advice) {
+	struct list_elem *e;
+
+	lock_acquire (&ra_lock);
+	for (e = list_begin (&spt->mmap_list); e != list_end (&spt->mmap_list);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		uint8_t *lo = region->addr;
+		uint8_t *hi = lo + region->page_cnt * PGSIZE;
+
+		if (hi <= (uint8_t *) start || lo >= (uint8_t *) end)
+			continue;
+		if (advice != MADV_WILLNEED) {
+			region->advice = advice;
+			region->ra_window = 0;
+			continue;
+		}
+
+		if (lo < (uint8_t *) start)
+			lo = start;
+		if (hi > (uint8_t *) end)
+			hi = end;
+		region->ra_pos = lo;
+		region->ra_limit = hi;
+		if (region->ra_end < hi)
+			region->ra_end = hi;
+		if (!region->ra_queued) {
+			list_push_back (&ra_queue, &region->ra_elem);
+			region->ra_queued = true;
+			cond_signal (&ra_work, &ra_lock);
+		}
+	}
+	lock_release (&ra_lock);
+}
+
+/* Loads the pages queued for readahead, a page at a time. */
+static void
+readahead_thread (void *aux UNUSED) {
+	for (;;) {
+		struct mmap_region *region;
+		struct page *page;
+		uint8_t *va;
+		bool loaded;
+
+		lock_acquire (&ra_lock);
+		while (list_empty (&ra_queue))
+			cond_wait (&ra_work, &ra_lock);
+		region = list_entry (list_pop_front (&ra_queue), struct mmap_region,
+				ra_elem);
+		if (region->ra_pos >= region->ra_limit) {
+			region->ra_queued = false;
+			lock_release (&ra_lock);
+			continue;
+		}
+		va = region->ra_pos;
+		region->ra_pos += PGSIZE;
+		list_push_back (&ra_queue, &region->ra_elem);
+		region->ra_busy = true;
+		lock_release (&ra_lock);
+
+		frame_lock_acquire ();
+		page = spt_find_page (region->spt, va);
+		loaded = page != NULL && page->frame == NULL && vm_prefetch_page (page);
+		frame_lock_release ();
+
+		lock_acquire (&ra_lock);
+		if (loaded)
+			ra_page_cnt++;
+		else if (page != NULL && page->frame == NULL)
+			region->ra_pos = region->ra_limit;      /* Out of free frames. */
+		region->ra_busy = false;
+		cond_broadcast (&ra_idle, &ra_lock);
+		lock_release (&ra_lock);
+	}
+}
+
+/* Prints readahead statistics. */
+void
+mmap_print_stats (void) {
+	printf ("Mmap: %lld sequential faults, %lld random faults, "
+			"%lld pages read ahead\n",
+			seq_fault_cnt, random_fault_cnt, ra_page_cnt);
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct list_elem *e;
+
+	for (e = list_begin (&spt->mmap_list); e != list_end (&spt->mmap_list);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		if (region->addr == addr) {
+			mmap_region_remove (spt, region);
+			return;
+		}
+	}
+}
+
+/* Shared text.
+
+   The read-only pages of an executable are VM_FILE pages marked
+   VM_TEXT.  Every process that runs the program would otherwise
+   read the same pages into frames of its own.  Instead, the
+   frame of a resident text page is entered in the text cache
+   under the page's inode, offset and length, and a text page
+   with the same key that faults later maps that frame read-only
+   too.  The pages that share a frame form its chain, as after
+   fork(), so the frame stays as long as one of them maps it.
+   Text pages are clean, so evicting the frame costs no I/O.
+
+   The entry goes away with the frame.  The cache is covered by
+   the frame table lock. */
+
+/* A frame in the text cache. */
+struct text_entry {
+	struct hash_elem elem;
+	struct inode *inode;
+	off_t ofs;
+	size_t read_bytes;
+	struct frame *frame;
+};
+
+static struct hash text_cache;
+
+/* Statistics. */
+static long long text_hit_cnt;      /* Text pages mapped from the cache. */
+static long long text_miss_cnt;     /* Text pages read from the file. */
+
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct text_entry *t = hash_entry (e, struct text_entry, elem);
+	uint64_t key[] = { (uint64_t) t->inode, t->ofs, t->read_bytes };
+
+	return hash_bytes (key, sizeof key);
+}
+
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_entry *a = hash_entry (a_, struct text_entry, elem);
+	const struct text_entry *b = hash_entry (b_, struct text_entry, elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->read_bytes < b->read_bytes;
+}
+
+static void
+text_cache_init (void) {
+	if (!hash_init (&text_cache, text_hash, text_less, NULL))
+		PANIC ("text cache: out of memory");
+}
+
+/* Fills in KEY for PAGE.  Returns false if PAGE is not a text
+ * page. */
+static bool
+text_key (struct page *page, struct text_entry *key) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT) {
+		struct file_load *load = page->uninit.aux;
+
+		if (!(page->uninit.type & VM_TEXT) || load == NULL)
+			return false;
+		key->inode = file_get_inode (load->fh->file);
+		key->ofs = load->ofs;
+		key->read_bytes = load->read_bytes;
+	} else {
+		if (VM_TYPE (page->operations->type) != VM_FILE || !page->file.text)
+			return false;
+		key->inode = file_get_inode (page->file.fh->file);
+		key->ofs = page->file.ofs;
+		key->read_bytes = page->file.read_bytes;
+	}
+	return true;
+}
+
+/* Returns the cached frame that holds the contents of PAGE, or a
+ * null pointer.  A frame that is being evicted is not returned:
+ * the page then gets a frame of its own. */
+struct frame *
+text_cache_lookup (struct page *page) {
+	struct text_entry key;
+	struct hash_elem *e;
+	struct frame *frame;
+
+	if (!text_key (page, &key))
+		return NULL;
+	e = hash_find (&text_cache, &key.elem);
+	if (e == NULL)
+		return NULL;
+	frame = hash_entry (e, struct text_entry, elem)->frame;
+	return !frame->in_io ? frame : NULL;
+}
+
+/* Maps PAGE, a text page without a frame, read-only to FRAME from
+ * text_cache_lookup().  An uninit PAGE is initialized without
+ * reading its file. */
+bool
+text_cache_map (struct page *page, struct frame *frame) {
+	frame_add_page (frame, page);
+	if (VM_TYPE (page->operations->type) == VM_UNINIT) {
+		((struct file_load *) page->uninit.aux)->filled = true;
+		if (!swap_in (page, frame->kva))
+			goto fail;
+	}
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva, false))
+		goto fail;
+	text_hit_cnt++;
+	return true;
+
+fail:
+	frame_remove_page (frame, page);
+	return false;
+}
+
+/* Enters FRAME, which PAGE has just been loaded into, in the text
+ * cache if PAGE is a text page whose contents are not cached
+ * yet. */
+void
+text_cache_insert (struct page *page, struct frame *frame) {
+	struct text_entry *t;
+
+	frame->text = NULL;
+	if (VM_TYPE (page->operations->type) != VM_FILE || !page->file.text)
+		return;
+	text_miss_cnt++;
+	t = malloc (sizeof *t);
+	if (t == NULL || !text_key (page, t))
+		goto fail;
+	t->frame = frame;
+	if (hash_insert (&text_cache, &t->elem) != NULL)
+		goto fail;
+	frame->text = t;
+	return;
+
+fail:
+	free (t);
+}
+
+/* Removes FRAME, which no page maps any longer, from the text
+ * cache if it is there. */
+void
+text_cache_remove (struct frame *frame) {
+	if (frame->text != NULL) {
+		hash_delete (&text_cache, &frame->text->elem);
+		free (frame->text);
+		frame->text = NULL;
+	}
+}
+
+/* Prints text cache statistics. */
+void
+text_cache_print_stats (void) {
+	printf ("Text: %zu frames shared, %lld pages mapped from them, "
+			"%lld pages read\n", hash_size (&text_cache), text_hit_cnt,
+			text_miss_cnt);
+}
+
+/* Returns a new handle on FILE with one reference, or a null
+ * pointer if memory is not available. */
+struct file_handle *
+file_handle_open (struct file *file) {
+	struct file_handle *fh = malloc (sizeof *fh);
+
+	if (fh == NULL)
+		return NULL;
+	fh->file = file_reopen (file);
+	if (fh->file == NULL) {
+		free (fh);
+		return NULL;
+	}
+	fh->ref_cnt = 1;
+	return fh;
+}
+
+/* Adds a reference to FH and returns it.  After fork() the
+ * handle is shared by two processes, so the count is updated
+ * with interrupts off. */
+struct file_handle *
+file_handle_get (struct file_handle *fh) {
+	enum intr_level old_level = intr_disable ();
+
+	fh->ref_cnt++;
+	intr_set_level (old_level);
+	return fh;
+}
+
+/* Drops a reference to FH, closing its file with the last one.
+ * FH may be a null pointer. */
+void
+file_handle_put (struct file_handle *fh) {
+	enum intr_level old_level;
+	bool last;
+
+	if (fh == NULL)
+		return;
+	old_level = intr_disable ();
+	ASSERT (fh->ref_cnt > 0);
+	last = --fh->ref_cnt == 0;
+	intr_set_level (old_level);
+	if (last) {
+		file_close (fh->file);
+		free (fh);
+	}
+}
+
+/* Returns a new description of a page loaded from READ_BYTES
+ * bytes of FH's file at OFS, holding a reference to FH, or a null
+ * pointer if memory is not available. */
+struct file_load *
+file_load_create (struct file_handle *fh, off_t ofs, size_t read_bytes) {
+	struct file_load *load;
+
+	ASSERT (read_bytes <= PGSIZE);
+
+	load = malloc (sizeof *load);
+	if (load == NULL)
+		return NULL;
+	load->fh = file_handle_get (fh);
+	load->ofs = ofs;
+	load->read_bytes = read_bytes;
+	load->filled = false;
+	return load;
+}
+
+/* Returns a copy of LOAD, or a null pointer if memory is not
+ * available. */
+struct file_load *
+file_load_dup (const struct file_load *load) {
+	return file_load_create (load->fh, load->ofs, load->read_bytes);
+}
+
+/* Fills the page at KVA as LOAD describes, unless LOAD is marked
+ * filled.  Returns true if successful, false on a short read. */
+bool
+file_load_read (const struct file_load *load, void *kva) {
+	if (load->filled)
+		return true;
+	if (file_read_at (load->fh->file, kva, load->read_bytes, load->ofs)
+			!= (off_t) load->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + load->read_bytes, 0, PGSIZE - load->read_bytes);
+	return true;
+}
+
+/* Loads PAGE, a lazily loaded anonymous page, on its first
+ * fault.  AUX is the page's struct file_load, which is freed
+ * here. */
+bool
+file_load_anon (struct page *page, void *aux) {
+	struct file_load *load = aux;
+	bool success = file_load_read (load, page->frame->kva);
+
+	file_load_free (load);
+	return success;
+}
+
+/* Drops LOAD's file reference and frees LOAD.  LOAD may be a null
+ * pointer. */
+void
+file_load_free (struct file_load *load) {
+	if (load != NULL) {
+		file_handle_put (load->fh);
+		free (load);
+	}
 }
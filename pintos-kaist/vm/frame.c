@@ -0,0 +1,567 @@
+/* frame.c: Frame table and page replacement. */
+
+#include "vm/frame.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+#include "vm/ksm.h"
+#include "vm/vm.h"
+
+/* The frame table holds every frame that backs a user page and
+   may be evicted.  A frame joins the table only once its page is
+   loaded and mapped, so a frame that is still being filled is
+   never chosen as a victim.
+
+   After fork(), several pages may map one frame copy-on-write,
+   and the text pages of processes running one program share
+   frames through the text cache.  They form a chain that starts at the frame's `page' member and
+   continues through each page's `share_next'.
+
+   One lock covers the table, the replacement policy and the
+   page <-> frame links.  kswapd drops it while it writes out the
+   pages of a victim, so that faults do not wait behind its I/O.
+   The victim is out of the table and the PTEs of its pages are
+   cleared before, and its `in_io' member is set until the
+   eviction is over: a thread that finds a page's frame in that
+   state waits in frame_wait_io() before it touches the page.
+   vm_map_frame() drops the lock the same way while it reads a
+   page from a file or the swap disk into a frame that is not in
+   the table yet.  A fault that finds no free frame and evicts
+   one itself keeps the lock, since its caller may hold other
+   frames out of the table meanwhile, where a thread that got the
+   lock could not tell them from frames that are being freed.
+
+   The frame descriptors form one array, indexed by physical page
+   number and allocated at boot, so a frame costs no malloc() and
+   the descriptor of a page is found by arithmetic.  It covers all
+   of RAM, since kernel pages lent to the user pool back user
+   pages too.  A frame is in the table if its `in_table' member is
+   set; walks over the table, such as the clock hand's, scan the
+   array in order. */
+
+static struct lock frame_lock;
+static struct condition io_done;    /* Signaled when in_io is cleared. */
+static struct frame *frames;        /* Descriptors, indexed by page number. */
+static size_t frames_size;          /* Number of elements in frames[]. */
+static size_t frame_cnt;            /* Number of frames in the table. */
+static size_t scan_pos;             /* Next frame for frame_scan_next(). */
+static const struct frame_policy *policy;
+
+/* Available policies; the first one is the default. */
+static const struct frame_policy *policies[] = {
+	&clockpro_policy,
+	&clock_policy,
+	NULL,
+};
+
+const char *frame_policy_name;
+
+/* Background reclaim.
+
+   The table tries to keep the number of free pages in the user
+   pool between two watermarks, so that a fault seldom has to
+   evict a frame, and wait for its swap I/O, before it can go on.
+   When an allocation leaves fewer than low_wmark pages free, the
+   kswapd thread wakes up and evicts frames, taking the frame
+   table lock for one frame at a time, until high_wmark pages are
+   free.  A fault that finds the pool empty all the same evicts a
+   frame itself, as the last resort.
+
+   kswapd also destroys the page tables of exited processes, so
+   that exit does not wait for them to be freed page by page. */
+
+static size_t low_wmark, high_wmark;
+static struct semaphore kswapd_wake;
+static bool kswapd_awake;           /* kswapd_wake raised or kswapd busy? */
+
+/* A page table left for kswapd to destroy. */
+struct dead_pml4 {
+	struct list_elem elem;
+	uint64_t *pml4;
+};
+static struct list dead_list;       /* Page tables to destroy. */
+static struct lock dead_lock;       /* Protects dead_list. */
+
+/* Statistics. */
+static long long evict_cnt;         /* Pages evicted. */
+static long long return_cnt;        /* Lent kernel pages given back. */
+static long long background_cnt;    /* Pages evicted by kswapd. */
+static long long kswapd_wake_cnt;   /* Times kswapd was woken. */
+static long long dead_cnt;          /* Page tables destroyed by kswapd. */
+
+static size_t return_lent_pages (size_t page_cnt);
+static void kswapd (void *aux);
+
+/* Initializes the frame table with the policy selected by
+   frame_policy_name. */
+void
+frame_init (void) {
+	const struct frame_policy **p = policies;
+
+	if (frame_policy_name != NULL)
+		while (*p != NULL && strcmp ((*p)->name, frame_policy_name))
+			p++;
+	if (*p == NULL)
+		PANIC ("unknown page replacement policy `%s'", frame_policy_name);
+	policy = *p;
+
+	lock_init (&frame_lock);
+	cond_init (&io_done);
+	frames_size = ram_pages;
+	frames = vcalloc (frames_size, sizeof *frames);
+	if (frames == NULL)
+		PANIC ("no memory for %zu frame descriptors", frames_size);
+	policy->init (palloc_free_cnt (PAL_USER));
+	palloc_set_reclaim_hook (return_lent_pages);
+
+	low_wmark = palloc_free_cnt (PAL_USER) / 64;
+	if (low_wmark < 4)
+		low_wmark = 4;
+	high_wmark = low_wmark * 2;
+	sema_init (&kswapd_wake, 0);
+	list_init (&dead_list);
+	lock_init (&dead_lock);
+	thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL);
+}
+
+/* Returns the descriptor of KVA, a page just obtained from the
+   page allocator for a user page, ready to be mapped. */
+struct frame *
+frame_alloc (void *kva) {
+	struct frame *f = &frames[pg_no (vtop (kva))];
+
+	ASSERT (pg_no (vtop (kva)) < frames_size);
+	ASSERT (!f->in_table);
+
+	f->kva = kva;
+	f->page = NULL;
+	f->text = NULL;
+	f->ksm_state = KSM_NONE;
+	f->in_io = false;
+	return f;
+}
+
+/* Wakes kswapd if the user pool is below its low watermark. */
+void
+frame_check_watermark (void) {
+	if (palloc_free_cnt (PAL_USER) < low_wmark && !kswapd_awake) {
+		kswapd_awake = true;
+		kswapd_wake_cnt++;
+		sema_up (&kswapd_wake);
+	}
+}
+
+/* Hands PML4, a page table that no thread uses any more, to
+   kswapd to destroy.  Destroys it right away if memory is short. */
+void
+frame_defer_destroy (uint64_t *pml4) {
+	struct dead_pml4 *d = malloc (sizeof *d);
+
+	if (d == NULL) {
+		pml4_destroy (pml4);
+		return;
+	}
+	d->pml4 = pml4;
+	lock_acquire (&dead_lock);
+	list_push_back (&dead_list, &d->elem);
+	lock_release (&dead_lock);
+	sema_up (&kswapd_wake);
+}
+
+/* Destroys the page tables in dead_list. */
+static void
+destroy_dead (void) {
+	for (;;) {
+		struct dead_pml4 *d = NULL;
+
+		lock_acquire (&dead_lock);
+		if (!list_empty (&dead_list))
+			d = list_entry (list_pop_front (&dead_list), struct dead_pml4, elem);
+		lock_release (&dead_lock);
+		if (d == NULL)
+			break;
+		pml4_destroy (d->pml4);
+		free (d);
+		dead_cnt++;
+	}
+}
+
+/* Evicts frames until high_wmark pages are free in the user
+   pool.  Evicting a lent kernel page does not add to the user
+   pool, so the work is bounded.  Returns false if it stopped
+   because no frame could be evicted. */
+static bool
+kswapd_reclaim (void) {
+	for (size_t budget = high_wmark;
+			budget > 0 && palloc_free_cnt (PAL_USER) < high_wmark; budget--) {
+		struct frame *f;
+		bool evicted;
+
+		lock_acquire (&frame_lock);
+		f = frame_victim ();
+		evicted = f != NULL && frame_evict (f, true);
+		if (evicted) {
+			palloc_free_page (f->kva);
+			background_cnt++;
+		}
+		lock_release (&frame_lock);
+		if (!evicted)
+			return false;
+	}
+	return true;
+}
+
+/* The background reclaim thread. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		bool progress;
+
+		sema_down (&kswapd_wake);
+		destroy_dead ();
+		progress = kswapd_reclaim ();
+		kswapd_awake = false;
+
+		/* The round may have run out of budget, and allocations
+		 * made during it did not wake us, so the pool may still
+		 * be low.  If so, start another round, unless this one
+		 * found nothing to evict. */
+		if (progress)
+			frame_check_watermark ();
+	}
+}
+
+void
+frame_lock_acquire (void) {
+	lock_acquire (&frame_lock);
+}
+
+void
+frame_lock_release (void) {
+	lock_release (&frame_lock);
+}
+
+/* Adds F, whose page has just been mapped, to the table. */
+void
+frame_table_insert (struct frame *f) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (f->page != NULL);
+
+	f->in_table = true;
+	frame_cnt++;
+	policy->insert (f);
+}
+
+/* Takes F out of the table. */
+static void
+table_unlink (struct frame *f) {
+	f->in_table = false;
+	frame_cnt--;
+	ksm_forget (f);
+}
+
+/* Returns the first frame in the table at or after *POS, going
+   around the array, and advances *POS past it.  Sets *WRAPPED if
+   it went around.  The table must not be empty. */
+static struct frame *
+table_next (size_t *pos, bool *wrapped) {
+	ASSERT (frame_cnt > 0);
+
+	for (;;) {
+		if (*pos >= frames_size) {
+			*pos = 0;
+			*wrapped = true;
+		}
+		if (frames[(*pos)++].in_table)
+			return &frames[*pos - 1];
+	}
+}
+
+/* Removes F from the table. */
+void
+frame_table_remove (struct frame *f) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	table_unlink (f);
+	policy->remove (f);
+}
+
+/* Returns the frame after the one that the previous call returned,
+   going around the table, or a null pointer if the table is empty.
+   Sets *WRAPPED to whether it started over at the front. */
+struct frame *
+frame_scan_next (bool *wrapped) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	*wrapped = false;
+	if (frame_cnt == 0) {
+		*wrapped = true;
+		return NULL;
+	}
+	return table_next (&scan_pos, wrapped);
+}
+
+/* Lets the policy drop whatever it remembers about PAGE, which
+   is being destroyed. */
+void
+frame_forget (struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	policy->forget (page);
+}
+
+/* Makes PAGE one of the pages that map F. */
+void
+frame_add_page (struct frame *f, struct page *page) {
+	struct vmstat *stat = &page->owner->vmstat;
+
+	page->share_next = f->page;
+	f->page = page;
+	page->frame = f;
+	if (++stat->rss > stat->max_rss)
+		stat->max_rss = stat->rss;
+}
+
+/* Removes PAGE from the pages that map F. */
+void
+frame_remove_page (struct frame *f, struct page *page) {
+	struct page **p = &f->page;
+
+	while (*p != page)
+		p = &(*p)->share_next;
+	*p = page->share_next;
+	page->share_next = NULL;
+	page->frame = NULL;
+	page->owner->vmstat.rss--;
+}
+
+/* Chooses a frame to evict and removes it from the table.
+   Returns a null pointer if the table is empty. */
+struct frame *
+frame_victim (void) {
+	struct frame *f;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	f = policy->victim ();
+	if (f != NULL)
+		table_unlink (f);
+	return f;
+}
+
+/* Marks F, which is not in the table, in_io and releases the
+   frame table lock, so that I/O on F can go on without it. */
+void
+frame_io_begin (struct frame *f) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (!f->in_table);
+
+	f->in_io = true;
+	lock_release (&frame_lock);
+}
+
+/* Takes the frame table lock again once the I/O on F is done,
+   and wakes the threads waiting for F. */
+void
+frame_io_end (struct frame *f) {
+	lock_acquire (&frame_lock);
+	f->in_io = false;
+	cond_broadcast (&io_done, &frame_lock);
+}
+
+/* Waits until no I/O is under way on the frame of PAGE, if any,
+   with the frame table lock dropped. */
+void
+frame_wait_io (struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	while (page->frame != NULL && page->frame->in_io)
+		cond_wait (&io_done, &frame_lock);
+}
+
+/* Unmaps the pages in F, which is not in the table, and writes
+   them out.  A shared frame is written out once per page, which
+   leaves every page with a private copy.  Afterward F is free for
+   reuse.  If some page cannot be written out, maps the remaining
+   pages again, puts F back in the table and returns false.
+
+   If UNLOCK is true, the frame table lock is dropped while each
+   page is written (see frame_io_begin()). */
+bool
+frame_evict (struct frame *f, bool unlock) {
+	struct page *page, *next;
+	bool written;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (f->page != NULL);
+
+	for (page = f->page; page != NULL; page = page->share_next)
+		pml4_clear_page (page->owner->pml4, page->va);
+	for (page = f->page; page != NULL; page = next) {
+		/* No one else changes the pages of F while it is in_io. */
+		next = page->share_next;
+		if (unlock)
+			frame_io_begin (f);
+		written = swap_out (page);
+		if (unlock)
+			frame_io_end (f);
+		if (written) {
+			frame_remove_page (f, page);
+			page->owner->vmstat.evictions++;
+		}
+	}
+
+	if (f->page != NULL) {
+		/* Set the PTEs present again rather than installing new
+		 * ones, which would lose the dirty bit of a page whose
+		 * write-back failed, and with it the page's changes. */
+		for (page = f->page; page != NULL; page = page->share_next)
+			pml4_restore_page (page->owner->pml4, page->va);
+		policy->restore (f);
+		frame_table_insert (f);
+		return false;
+	}
+	text_cache_remove (f);
+	evict_cnt++;
+	return true;
+}
+
+/* Returns whether any page in F was accessed since the last call,
+   and clears their accessed bits. */
+bool
+frame_test_and_clear_accessed (struct frame *f) {
+	bool accessed = false;
+
+	for (struct page *page = f->page; page != NULL; page = page->share_next) {
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (pml4_is_accessed (pml4, page->va)) {
+			pml4_set_accessed (pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void) {
+	int64_t ticks = timer_ticks ();
+
+	printf ("Frames: %zu resident, policy %s, %lld evictions (%lld/s), "
+			"%lld pages returned to the kernel pool\n", frame_cnt,
+			policy->name, evict_cnt,
+			ticks > 0 ? evict_cnt * TIMER_FREQ / ticks : 0, return_cnt);
+	printf ("Frames: %zu descriptors of %zu bytes, %zu kB\n", frames_size,
+			sizeof *frames, frames_size * sizeof *frames / 1024);
+	printf ("Reclaim: watermarks %zu/%zu, %lld direct, %lld background "
+			"(kswapd woken %lld times), %lld page tables destroyed\n",
+			low_wmark, high_wmark, evict_cnt - background_cnt - return_cnt,
+			background_cnt, kswapd_wake_cnt, dead_cnt);
+	if (policy->print_stats != NULL)
+		policy->print_stats ();
+}
+
+/* Palloc reclaim hook: evicts up to PAGE_CNT user pages that sit
+   in kernel pages lent to the user pool, and frees those pages.
+   Gives up at once if the frame table is busy, which includes a
+   kernel allocation made by the eviction path itself.  Holds the
+   lock across the evictions, since its caller may hold others. */
+static size_t
+return_lent_pages (size_t page_cnt) {
+	size_t freed = 0;
+
+	if (intr_context () || intr_get_level () == INTR_OFF
+			|| lock_held_by_current_thread (&frame_lock)
+			|| !lock_try_acquire (&frame_lock))
+		return 0;
+
+	for (size_t i = 0; i < frames_size && freed < page_cnt; i++) {
+		struct frame *f = &frames[i];
+
+		if (!f->in_table || !palloc_is_lent (f->kva))
+			continue;
+		frame_table_remove (f);
+		if (!frame_evict (f, false))
+			break;
+		palloc_free_page (f->kva);
+		freed++;
+	}
+	return_cnt += freed;
+	lock_release (&frame_lock);
+	return freed;
+}
+
+/* Second-chance clock.
+
+   The hand sweeps the frame descriptor array in order.  It clears
+   the accessed bit of each frame in the table that it passes and
+   stops at the first frame whose bit was already clear.  The
+   array is the ring, so the policy keeps no list of its own. */
+
+static size_t clock_hand;
+static long long clock_scan_cnt;    /* Frames the hand passed. */
+static long long clock_victim_cnt;  /* Victims it chose. */
+
+static void
+clock_init (size_t frame_cnt UNUSED) {
+}
+
+static void
+clock_insert (struct frame *f UNUSED) {
+}
+
+static void
+clock_remove (struct frame *f UNUSED) {
+}
+
+static struct frame *
+clock_victim (void) {
+	while (frame_cnt > 0) {
+		bool wrapped;
+		struct frame *f = table_next (&clock_hand, &wrapped);
+
+		clock_scan_cnt++;
+		if (!frame_test_and_clear_accessed (f)) {
+			clock_victim_cnt++;
+			return f;
+		}
+	}
+	return NULL;
+}
+
+static void
+clock_restore (struct frame *f UNUSED) {
+}
+
+static void
+clock_forget (struct page *page UNUSED) {
+}
+
+static void
+clock_print_stats (void) {
+	printf ("Clock: %lld frames scanned for %lld victims\n", clock_scan_cnt,
+			clock_victim_cnt);
+}
+
+const struct frame_policy clock_policy = {
+	.name = "clock",
+	.init = clock_init,
+	.insert = clock_insert,
+	.remove = clock_remove,
+	.victim = clock_victim,
+	.restore = clock_restore,
+	.forget = clock_forget,
+	.print_stats = clock_print_stats,
+};
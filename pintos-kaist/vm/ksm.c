@@ -0,0 +1,261 @@
+/* ksm.c: Merging of identical anonymous pages. */
+
+#include "vm/ksm.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/vm.h"
+
+/* Children forked from one parent, or processes working on the
+   same data, often fill many anonymous pages with the same
+   contents.  When enabled, the ksm thread walks the frame table a
+   few frames at a time, and when it finds two anonymous frames
+   with equal contents, it maps the pages of one into the other,
+   read-only, and frees the first.  The merged frame then looks
+   just like a frame shared copy-on-write after fork(): the first
+   write through one of its pages gives that page a private copy
+   again in vm_handle_wp().
+
+   As in Linux, frames are found through two tables keyed by a
+   checksum of their contents.  stable_table holds merged frames,
+   which are write-protected, so that their contents cannot
+   change.  unstable_table holds frames that are still writable;
+   a match there is compared again once both frames are
+   write-protected, and the table is emptied after each pass over
+   the frame table.  A frame enters it only if its checksum did
+   not change since the previous pass, which keeps out the frames
+   that are written all the time.
+
+   Everything here runs with the frame table lock held. */
+
+#define KSM_SLEEP_MS 20             /* Pause between rounds. */
+
+int ksm_pages_per_scan;
+
+static struct hash stable_table;
+static struct hash unstable_table;
+
+/* Statistics. */
+static long long scan_cnt;          /* Frames looked at. */
+static long long pass_cnt;          /* Passes over the frame table. */
+static long long merge_cnt;         /* Frames merged into another. */
+static long long unmerge_cnt;       /* Writes to merged frames. */
+
+static void ksm_thread (void *aux);
+
+static uint64_t
+frame_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_elem)->ksm_sum;
+}
+
+static bool
+frame_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_elem)->ksm_sum
+		< hash_entry (b, struct frame, ksm_elem)->ksm_sum;
+}
+
+/* Starts the ksm thread, if merging is enabled. */
+void
+ksm_init (void) {
+	if (ksm_pages_per_scan <= 0)
+		return;
+	if (!hash_init (&stable_table, frame_hash, frame_less, NULL)
+			|| !hash_init (&unstable_table, frame_hash, frame_less, NULL))
+		PANIC ("ksm: out of memory");
+	thread_create ("ksm", PRI_DEFAULT, ksm_thread, NULL);
+}
+
+/* Drops F from the tables.  The frame table calls this whenever F
+   leaves it. */
+void
+ksm_forget (struct frame *f) {
+	if (f->ksm_state == KSM_STABLE)
+		hash_delete (&stable_table, &f->ksm_elem);
+	else if (f->ksm_state == KSM_UNSTABLE)
+		hash_delete (&unstable_table, &f->ksm_elem);
+	f->ksm_state = KSM_NONE;
+}
+
+/* Called by vm_handle_wp() before it lets a page write to F,
+   which it either copies or maps writable. */
+void
+ksm_write_fault (struct frame *f) {
+	if (f->ksm_state == KSM_STABLE) {
+		unmerge_cnt++;
+		ksm_forget (f);
+	}
+}
+
+/* Returns a checksum of the page at KVA. */
+static uint64_t
+checksum (const void *kva) {
+	const uint64_t *p = kva;
+	uint64_t h = 0;
+
+	for (size_t i = 0; i < PGSIZE / sizeof *p; i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+/* Returns true if F may be merged: all its pages are anonymous,
+   and none is part of a huge page, which merging would split. */
+static bool
+mergeable (struct frame *f) {
+	if (f->text != NULL)
+		return false;
+	for (struct page *page = f->page; page != NULL; page = page->share_next)
+		if (VM_TYPE (page->operations->type) != VM_ANON
+				|| pml4_is_huge (page->owner->pml4, page->va))
+			return false;
+	return true;
+}
+
+/* Maps the pages of F read-only. */
+static void
+write_protect (struct frame *f) {
+	for (struct page *page = f->page; page != NULL; page = page->share_next) {
+		/* The PTE exists already, so this cannot fail. */
+		pml4_clear_page (page->owner->pml4, page->va);
+		pml4_set_page (page->owner->pml4, page->va, f->kva, false);
+	}
+}
+
+/* Moves the pages of F to KEEP, a write-protected frame with the
+   same contents, and frees F. */
+static void
+merge (struct frame *f, struct frame *keep) {
+	struct page *page;
+
+	frame_table_remove (f);
+	while ((page = f->page) != NULL) {
+		pml4_clear_page (page->owner->pml4, page->va);
+		frame_remove_page (f, page);
+		frame_add_page (keep, page);
+		pml4_set_page (page->owner->pml4, page->va, keep->kva, false);
+	}
+	palloc_free_page (f->kva);
+	merge_cnt++;
+}
+
+/* Looks for a frame to merge F with, and records F as a candidate
+   if there is none. */
+static void
+scan_frame (struct frame *f) {
+	struct hash_elem *e;
+	uint64_t sum;
+	bool steady;
+
+	scan_cnt++;
+	if (f->ksm_state == KSM_STABLE || f->ksm_state == KSM_UNSTABLE
+			|| !mergeable (f))
+		return;
+
+	sum = checksum (f->kva);
+	steady = f->ksm_state == KSM_SEEN && f->ksm_sum == sum;
+	f->ksm_sum = sum;
+	f->ksm_state = KSM_SEEN;
+
+	e = hash_find (&stable_table, &f->ksm_elem);
+	if (e != NULL) {
+		struct frame *keep = hash_entry (e, struct frame, ksm_elem);
+
+		/* KEEP is write-protected already.  F must be too before
+		 * the comparison, or a write to it in between would be
+		 * lost.  If they differ, F stays read-only and its next
+		 * write takes the copy-on-write path. */
+		write_protect (f);
+		if (!memcmp (keep->kva, f->kva, PGSIZE)) {
+			merge (f, keep);
+			return;
+		}
+	}
+	if (!steady)
+		return;
+
+	e = hash_find (&unstable_table, &f->ksm_elem);
+	if (e != NULL) {
+		struct frame *keep = hash_entry (e, struct frame, ksm_elem);
+
+		/* Either frame may have changed since its checksum was
+		 * taken.  Once they are write-protected, neither can. */
+		write_protect (keep);
+		write_protect (f);
+		if (!memcmp (keep->kva, f->kva, PGSIZE)) {
+			ksm_forget (keep);
+			if (hash_insert (&stable_table, &keep->ksm_elem) == NULL)
+				keep->ksm_state = KSM_STABLE;
+			merge (f, keep);
+		}
+	} else if (hash_insert (&unstable_table, &f->ksm_elem) == NULL)
+		f->ksm_state = KSM_UNSTABLE;
+}
+
+/* Returns a frame of the unstable table to the KSM_SEEN state. */
+static void
+unstable_clear (struct hash_elem *e, void *aux UNUSED) {
+	hash_entry (e, struct frame, ksm_elem)->ksm_state = KSM_SEEN;
+}
+
+/* Scans ksm_pages_per_scan frames every KSM_SLEEP_MS
+   milliseconds, taking the frame table lock for one frame at a
+   time. */
+static void
+ksm_thread (void *aux UNUSED) {
+	for (;;) {
+		for (int i = 0; i < ksm_pages_per_scan; i++) {
+			struct frame *f;
+			bool wrapped;
+
+			frame_lock_acquire ();
+			f = frame_scan_next (&wrapped);
+			if (wrapped) {
+				hash_clear (&unstable_table, unstable_clear);
+				pass_cnt++;
+			}
+			if (f != NULL)
+				scan_frame (f);
+			frame_lock_release ();
+			if (f == NULL)
+				break;
+		}
+		timer_msleep (KSM_SLEEP_MS);
+	}
+}
+
+/* Pages beyond the first that map a merged frame, as counted by
+   count_shared(). */
+static size_t shared_cnt;
+
+static void
+count_shared (struct hash_elem *e, void *aux UNUSED) {
+	struct frame *f = hash_entry (e, struct frame, ksm_elem);
+
+	for (struct page *page = f->page->share_next; page != NULL;
+			page = page->share_next)
+		shared_cnt++;
+}
+
+/* Prints merging statistics. */
+void
+ksm_print_stats (void) {
+	if (ksm_pages_per_scan <= 0)
+		return;
+
+	frame_lock_acquire ();
+	shared_cnt = 0;
+	hash_apply (&stable_table, count_shared);
+	printf ("KSM: %lld frames scanned in %lld passes, %lld merged, "
+			"%lld unmerged by writes; %zu merged frames save %zu pages "
+			"(%zu kB)\n", scan_cnt, pass_cnt, merge_cnt, unmerge_cnt,
+			hash_size (&stable_table), shared_cnt, shared_cnt * PGSIZE / 1024);
+	frame_lock_release ();
+}
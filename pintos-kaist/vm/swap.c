@@ -0,0 +1,411 @@
+/* swap.c: Swap slots on the swap disks. */
+
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Each swap disk is divided into page-sized slots.
+
+   Slots are handed out by a cursor that moves forward through
+   free slots, so pages evicted one after another land next to
+   each other on disk.  swap_write() does not write a page right
+   away: it copies it into the disk's write buffer, which goes to
+   disk in a single command once it holds CLUSTER_PAGES pages, or
+   as soon as the next slot would not continue its run.
+
+   Pages evicted together tend to be needed together again, so
+   swap_read() reads the allocated slots around the wanted one,
+   within its RA_PAGES-aligned window, in one command as well.  It
+   keeps the neighbors in a small swap cache, and their own faults
+   are then served from memory.  A page still in the write buffer
+   is served from there.
+
+   There may be several swap disks (see -swap).  Writes go to the
+   disks of the highest priority that have free slots, taking
+   turns among them every CLUSTER_PAGES pages, so that each disk
+   still sees whole clusters.  Each disk has its own lock, held
+   across its I/O.  Swap-ins and kswapd's writes run without the
+   frame table lock (see vm/frame.c), so a fault that reads one
+   disk need not wait for kswapd writing to a disk on the other
+   IDE channel.  A swap_slot_t holds the index of its disk above
+   SLOT_DEV_SHIFT and the slot within the disk below. */
+
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+#define CLUSTER_PAGES 8             /* Pages per clustered write. */
+#define RA_PAGES 8                  /* Pages per readahead window. */
+#define CACHE_PAGES 16              /* Pages in each swap cache. */
+#define SWAP_DEV_MAX 4              /* Most swap disks. */
+#define SLOT_DEV_SHIFT 32
+
+/* Swap cache entry. */
+struct cache_entry {
+	size_t slot;                    /* SWAP_SLOT_NONE if unused. */
+	void *page;                     /* Contents of SLOT. */
+};
+
+/* A swap disk.  Slot numbers here are within the disk. */
+struct swap_dev {
+	struct disk *disk;
+	char name[8];                   /* Name, e.g. "hd1:1". */
+	int prio;                       /* Priority; higher is used first. */
+	struct lock lock;               /* Protects the rest. */
+	struct bitmap *slot_map;        /* Allocated slots. */
+	size_t free_cnt;                /* Free slots. */
+	size_t next_slot;               /* Allocation cursor. */
+
+	/* Write buffer, holding the pages of slots
+	   [wb_first, wb_first + wb_cnt). */
+	uint8_t *wb_buf;
+	size_t wb_first;
+	size_t wb_cnt;
+	uint32_t wb_dead;               /* Bit I set: slot wb_first + I freed. */
+
+	/* Readahead buffer, RA_PAGES pages. */
+	uint8_t *ra_buf;
+
+	struct cache_entry cache[CACHE_PAGES];
+	size_t cache_hand;              /* Next entry to replace. */
+
+	/* Statistics. */
+	long long out_cnt;              /* Pages written. */
+	long long in_cnt;               /* Pages read. */
+	long long write_io_cnt;         /* Write commands. */
+	long long read_io_cnt;          /* Read commands. */
+	long long ra_cnt;               /* Pages read ahead. */
+	long long hit_cnt;              /* Reads served from memory. */
+};
+
+static struct swap_dev devs[SWAP_DEV_MAX];
+static size_t dev_cnt;
+
+/* Striping, under alloc_lock. */
+static struct lock alloc_lock;
+static size_t cur_dev;              /* Disk taking writes. */
+static size_t cur_run;              /* Pages written to it in a row. */
+
+const char *swap_devices;
+
+static void dev_add (struct disk *, int prio);
+static void wb_flush (struct swap_dev *);
+
+/* Initializes swapping to the disks named by swap_devices, or to
+   DISK alone if there are none.  Without a swap disk, every
+   swap_write() fails. */
+void
+swap_init (struct disk *disk) {
+	lock_init (&alloc_lock);
+	if (swap_devices == NULL) {
+		if (disk != NULL)
+			dev_add (disk, 0);
+		return;
+	}
+
+	/* Parse "hdC:D[@PRIO],...". */
+	char *spec = malloc (strlen (swap_devices) + 1);
+	char *token, *save_ptr;
+
+	if (spec == NULL)
+		PANIC ("swap: out of memory");
+	strlcpy (spec, swap_devices, strlen (swap_devices) + 1);
+	for (token = strtok_r (spec, ",", &save_ptr); token != NULL;
+			token = strtok_r (NULL, ",", &save_ptr)) {
+		char *prio = strchr (token, '@');
+		struct disk *d;
+
+		if (strlen (token) < 5 || memcmp (token, "hd", 2) || token[3] != ':'
+				|| (token[2] != '0' && token[2] != '1')
+				|| (token[4] != '0' && token[4] != '1')
+				|| (token[5] != '\0' && token[5] != '@'))
+			PANIC ("swap: bad device `%s'", token);
+		d = disk_get (token[2] - '0', token[4] - '0');
+		if (d == NULL)
+			PANIC ("swap: no disk %.5s", token);
+		dev_add (d, prio != NULL ? atoi (prio + 1) : 0);
+	}
+	free (spec);
+}
+
+/* Adds DISK as a swap disk with priority PRIO. */
+static void
+dev_add (struct disk *disk, int prio) {
+	struct swap_dev *d = &devs[dev_cnt];
+
+	if (dev_cnt == SWAP_DEV_MAX)
+		PANIC ("swap: more than %d disks", SWAP_DEV_MAX);
+	for (size_t i = 0; i < dev_cnt; i++)
+		if (devs[i].disk == disk)
+			PANIC ("swap: %s given twice", devs[i].name);
+
+	d->disk = disk;
+	d->prio = prio;
+	for (int c = 0; c < 2; c++)
+		for (int n = 0; n < 2; n++)
+			if (disk_get (c, n) == disk)
+				snprintf (d->name, sizeof d->name, "hd%d:%d", c, n);
+	lock_init (&d->lock);
+	d->slot_map = bitmap_create (disk_size (disk) / SECTORS_PER_SLOT);
+	d->wb_buf = palloc_get_multiple (0, CLUSTER_PAGES);
+	d->ra_buf = palloc_get_multiple (0, RA_PAGES);
+	if (d->slot_map == NULL || d->wb_buf == NULL || d->ra_buf == NULL)
+		PANIC ("swap: out of memory");
+	d->free_cnt = bitmap_size (d->slot_map);
+	for (int i = 0; i < CACHE_PAGES; i++) {
+		d->cache[i].slot = SWAP_SLOT_NONE;
+		d->cache[i].page = palloc_get_page (PAL_ASSERT);
+	}
+	dev_cnt++;
+}
+
+/* Returns true if SLOT is waiting in D's write buffer. */
+static inline bool
+in_wb (struct swap_dev *d, size_t slot) {
+	return slot >= d->wb_first && slot < d->wb_first + d->wb_cnt;
+}
+
+/* Returns SLOT's entry in D's swap cache, or a null pointer. */
+static struct cache_entry *
+cache_lookup (struct swap_dev *d, size_t slot) {
+	for (int i = 0; i < CACHE_PAGES; i++)
+		if (d->cache[i].slot == slot)
+			return &d->cache[i];
+	return NULL;
+}
+
+/* Puts a copy of DATA, the contents of SLOT, in D's swap cache. */
+static void
+cache_insert (struct swap_dev *d, size_t slot, const void *data) {
+	struct cache_entry *e = &d->cache[d->cache_hand];
+
+	d->cache_hand = (d->cache_hand + 1) % CACHE_PAGES;
+	e->slot = slot;
+	memcpy (e->page, data, PGSIZE);
+}
+
+/* Allocates a slot on D, preferring the one after the last slot
+   allocated, then the start of a free run of CLUSTER_PAGES slots.
+   Returns SWAP_SLOT_NONE if D is full. */
+static size_t
+slot_alloc (struct swap_dev *d) {
+	size_t slot_cnt = bitmap_size (d->slot_map);
+	size_t slot = d->next_slot;
+
+	if (slot >= slot_cnt || bitmap_test (d->slot_map, slot)) {
+		slot = bitmap_scan (d->slot_map, 0, CLUSTER_PAGES, false);
+		if (slot == BITMAP_ERROR)
+			slot = bitmap_scan (d->slot_map, 0, 1, false);
+		if (slot == BITMAP_ERROR)
+			return SWAP_SLOT_NONE;
+	}
+	bitmap_mark (d->slot_map, slot);
+	d->free_cnt--;
+	d->next_slot = slot + 1;
+	return slot;
+}
+
+/* Marks SLOT on D free. */
+static void
+slot_release (struct swap_dev *d, size_t slot) {
+	bitmap_reset (d->slot_map, slot);
+	d->free_cnt++;
+}
+
+/* Chooses the disk for the next write: among the disks of the
+   highest priority that have free slots, the current one, or the
+   next one after CLUSTER_PAGES writes.  Returns its index, or
+   SWAP_DEV_MAX if every disk is full. */
+static size_t
+pick_dev (void) {
+	size_t best = SWAP_DEV_MAX, start;
+
+	lock_acquire (&alloc_lock);
+	start = cur_dev;
+	if (++cur_run > CLUSTER_PAGES)
+		start++;
+	for (size_t i = 0; i < dev_cnt; i++) {
+		size_t k = (start + i) % dev_cnt;
+		if (devs[k].free_cnt > 0
+				&& (best == SWAP_DEV_MAX || devs[k].prio > devs[best].prio))
+			best = k;
+	}
+	if (best != SWAP_DEV_MAX && best != cur_dev) {
+		cur_dev = best;
+		cur_run = 1;
+	}
+	lock_release (&alloc_lock);
+	return best;
+}
+
+/* Writes the page at KVA to a newly allocated slot and returns
+   the slot, or SWAP_SLOT_NONE if the swap disks are full or
+   missing.  The write may be deferred; KVA may be reused as soon
+   as this returns. */
+swap_slot_t
+swap_write (const void *kva) {
+	for (;;) {
+		size_t k = pick_dev (), slot;
+		struct swap_dev *d = &devs[k];
+
+		if (k == SWAP_DEV_MAX)
+			return SWAP_SLOT_NONE;
+
+		lock_acquire (&d->lock);
+		slot = slot_alloc (d);
+		if (slot != SWAP_SLOT_NONE) {
+			if (d->wb_cnt > 0 && slot != d->wb_first + d->wb_cnt)
+				wb_flush (d);
+			if (d->wb_cnt == 0)
+				d->wb_first = slot;
+			memcpy (d->wb_buf + d->wb_cnt * PGSIZE, kva, PGSIZE);
+			d->wb_cnt++;
+			d->out_cnt++;
+			if (d->wb_cnt == CLUSTER_PAGES)
+				wb_flush (d);
+		}
+		lock_release (&d->lock);
+
+		/* D may have filled up since pick_dev() looked. */
+		if (slot != SWAP_SLOT_NONE)
+			return ((swap_slot_t) k << SLOT_DEV_SHIFT) | slot;
+	}
+}
+
+/* Returns true if SLOT on D holds a page that is only on disk. */
+static bool
+on_disk_only (struct swap_dev *d, size_t slot) {
+	return bitmap_test (d->slot_map, slot) && !in_wb (d, slot)
+		&& cache_lookup (d, slot) == NULL;
+}
+
+/* Reads SLOT on D into KVA, together with the neighbors of SLOT
+   in its readahead window that are allocated and only on disk,
+   which go into the swap cache. */
+static void
+read_cluster (struct swap_dev *d, size_t slot, void *kva) {
+	size_t base = slot - slot % RA_PAGES;
+	size_t lo = slot, hi = slot + 1;
+
+	while (lo > base && on_disk_only (d, lo - 1))
+		lo--;
+	while (hi < base + RA_PAGES && hi < bitmap_size (d->slot_map)
+			&& on_disk_only (d, hi))
+		hi++;
+
+	disk_read_multiple (d->disk, lo * SECTORS_PER_SLOT, d->ra_buf,
+			(hi - lo) * SECTORS_PER_SLOT);
+	d->read_io_cnt++;
+	for (size_t s = lo; s < hi; s++) {
+		const uint8_t *data = d->ra_buf + (s - lo) * PGSIZE;
+		if (s == slot)
+			memcpy (kva, data, PGSIZE);
+		else {
+			cache_insert (d, s, data);
+			d->ra_cnt++;
+		}
+	}
+}
+
+/* Returns the disk that holds SLOT, and stores the slot within it
+   in *DEV_SLOT.  Returns a null pointer if SLOT is invalid. */
+static struct swap_dev *
+slot_dev (swap_slot_t slot, size_t *dev_slot) {
+	size_t k = slot >> SLOT_DEV_SHIFT;
+
+	*dev_slot = slot & (((swap_slot_t) 1 << SLOT_DEV_SHIFT) - 1);
+	if (k >= dev_cnt || *dev_slot >= bitmap_size (devs[k].slot_map))
+		return NULL;
+	return &devs[k];
+}
+
+/* Reads SLOT into the page at KVA and frees SLOT.  Returns true
+   if successful. */
+bool
+swap_read (swap_slot_t slot_, void *kva) {
+	struct cache_entry *e;
+	struct swap_dev *d;
+	size_t slot;
+
+	d = slot_dev (slot_, &slot);
+	if (d == NULL)
+		return false;
+
+	lock_acquire (&d->lock);
+	ASSERT (bitmap_test (d->slot_map, slot));
+	if (in_wb (d, slot)) {
+		memcpy (kva, d->wb_buf + (slot - d->wb_first) * PGSIZE, PGSIZE);
+		d->wb_dead |= 1u << (slot - d->wb_first);
+		d->hit_cnt++;
+	} else {
+		if ((e = cache_lookup (d, slot)) != NULL) {
+			memcpy (kva, e->page, PGSIZE);
+			e->slot = SWAP_SLOT_NONE;
+			d->hit_cnt++;
+		} else
+			read_cluster (d, slot, kva);
+		slot_release (d, slot);
+	}
+	d->in_cnt++;
+	lock_release (&d->lock);
+	return true;
+}
+
+/* Frees SLOT without reading it. */
+void
+swap_free (swap_slot_t slot_) {
+	struct cache_entry *e;
+	struct swap_dev *d;
+	size_t slot;
+
+	d = slot_dev (slot_, &slot);
+	ASSERT (d != NULL);
+
+	lock_acquire (&d->lock);
+	if (in_wb (d, slot))
+		d->wb_dead |= 1u << (slot - d->wb_first);
+	else {
+		if ((e = cache_lookup (d, slot)) != NULL)
+			e->slot = SWAP_SLOT_NONE;
+		slot_release (d, slot);
+	}
+	lock_release (&d->lock);
+}
+
+/* Prints swap statistics, a line per disk. */
+void
+swap_print_stats (void) {
+	for (size_t i = 0; i < dev_cnt; i++) {
+		struct swap_dev *d = &devs[i];
+
+		printf ("Swap %s (priority %d): %zu of %zu slots used, "
+				"%lld pages out in %lld writes, %lld pages in in %lld reads, "
+				"%lld read ahead, %lld hits\n", d->name, d->prio,
+				bitmap_size (d->slot_map) - d->free_cnt,
+				bitmap_size (d->slot_map), d->out_cnt, d->write_io_cnt,
+				d->in_cnt, d->read_io_cnt, d->ra_cnt, d->hit_cnt);
+	}
+}
+
+/* Writes D's write buffer to disk and releases the slots that
+   were freed while they waited in it. */
+static void
+wb_flush (struct swap_dev *d) {
+	ASSERT (lock_held_by_current_thread (&d->lock));
+
+	if (d->wb_cnt == 0)
+		return;
+	disk_write_multiple (d->disk, d->wb_first * SECTORS_PER_SLOT, d->wb_buf,
+			d->wb_cnt * SECTORS_PER_SLOT);
+	d->write_io_cnt++;
+	for (size_t i = 0; i < d->wb_cnt; i++)
+		if (d->wb_dead & (1u << i))
+			slot_release (d, d->wb_first + i);
+	d->wb_cnt = 0;
+	d->wb_dead = 0;
+}
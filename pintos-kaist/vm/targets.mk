@@ -2,4 +2,10 @@ vm_SRC = vm/vm.c          # Main api proxy
 vm_SRC += vm/uninit.c     # Uninitialized page
 vm_SRC += vm/anon.c       # Anonymous page
 vm_SRC += vm/file.c       # File mapped page
+vm_SRC += vm/frame.c      # Frame table
+vm_SRC += vm/clockpro.c   # CLOCK-Pro replacement
+vm_SRC += vm/swap.c       # Swap disk
+vm_SRC += vm/zswap.c      # Compressed swap cache
+vm_SRC += vm/ksm.c        # Same-page merging
+vm_SRC += vm/trace.c      # Fault latency tracer
 vm_SRC += vm/inspect.c    # Testing utility
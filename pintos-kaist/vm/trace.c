@@ -0,0 +1,63 @@
+/* trace.c: Page fault latency tracer. */
+
+#include "vm/trace.h"
+#ifdef VMTRACE
+#include <stdio.h>
+
+/* Each phase has a histogram laid out like the fault latency
+   histogram in vm.c: bucket 0 counts spans under 2^TRACE_HIST_MIN
+   TSC cycles, each further bucket twice as many, and the last
+   bucket all the rest.  The total cycles give the mean, which
+   shows where an average fault spends its time.
+
+   Like the other VM statistics, the counters are updated without
+   a lock, so a rare concurrent update may be lost. */
+
+#define TRACE_HIST_MIN 8
+#define TRACE_HIST_CNT 20
+
+struct phase {
+	long long hist[TRACE_HIST_CNT];
+	long long cnt;              /* Spans recorded. */
+	uint64_t cycles;            /* Their total length. */
+};
+
+static struct phase phases[VMTRACE_PHASE_CNT];
+
+static const char *phase_name[VMTRACE_PHASE_CNT] = {
+	"fault", "lookup", "lock", "get_frame", "evict", "swap_in",
+};
+
+/* Charges a span of CYCLES to PHASE. */
+void
+vmtrace_add (enum vmtrace_phase phase, uint64_t cycles) {
+	struct phase *p = &phases[phase];
+	int i = 0;
+
+	p->cnt++;
+	p->cycles += cycles;
+	for (cycles >>= TRACE_HIST_MIN; cycles > 0 && i < TRACE_HIST_CNT - 1;
+			cycles >>= 1)
+		i++;
+	p->hist[i]++;
+}
+
+/* Prints one line per phase that recorded a span. */
+void
+vmtrace_print_stats (void) {
+	for (int ph = 0; ph < VMTRACE_PHASE_CNT; ph++) {
+		struct phase *p = &phases[ph];
+
+		if (p->cnt == 0)
+			continue;
+		printf ("VM trace: %s: %lld spans, mean %llu cycles:", phase_name[ph],
+				p->cnt, p->cycles / p->cnt);
+		for (int i = 0; i < TRACE_HIST_CNT; i++)
+			if (p->hist[i] > 0)
+				printf (" %s2^%d: %lld", i < TRACE_HIST_CNT - 1 ? "<" : ">=",
+						TRACE_HIST_MIN + (i < TRACE_HIST_CNT - 1 ? i : i - 1),
+						p->hist[i]);
+		printf ("\n");
+	}
+}
+#endif /* VMTRACE */
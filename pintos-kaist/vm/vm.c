@@ -1,8 +1,58 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "intrinsic.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 #include "vm/vm.h"
+#include "vm/frame.h"
 #include "vm/inspect.h"
+#include "vm/ksm.h"
+#include "vm/swap.h"
+#include "vm/trace.h"
+#include "vm/zswap.h"
+
+/* Statistics. */
+static long long fault_cnt;         /* Page faults resolved. */
+static long long around_cnt;        /* Neighbors loaded by fault-around. */
+static long long around_read_cnt;   /* File reads made for them. */
+static long long populate_cnt;      /* Pages loaded by vm_populate(). */
+static long long populate_read_cnt; /* File reads made for them. */
+static long long zero_map_cnt;      /* Read faults served by the zero page. */
+static long long zero_copy_cnt;     /* Zero pages written to later. */
+static long long huge_cnt;          /* Huge pages mapped. */
+static long long huge_fail_cnt;     /* ...that found no aligned frames. */
+static long long stack_grow_cnt;    /* Faults that grew a stack. */
+static long long stack_page_cnt;    /* Pages they added. */
+static long long stack_prefault_cnt;  /* ...that were mapped in advance. */
+
+/* Fault latency histogram: bucket 0 counts faults handled in
+ * under 2^FAULT_HIST_MIN TSC cycles, and each further bucket
+ * twice as many, up to the last, which counts all the rest. */
+#define FAULT_HIST_MIN 10
+#define FAULT_HIST_CNT 16
+static long long fault_hist[FAULT_HIST_CNT];
+
+static void
+fault_hist_add (uint64_t cycles) {
+	int i = 0;
+
+	for (cycles >>= FAULT_HIST_MIN; cycles > 0 && i < FAULT_HIST_CNT - 1;
+			cycles >>= 1)
+		i++;
+	fault_hist[i]++;
+}
+
+/* The zero page (see vm_map_zero_page()). */
+static void *zero_kva;
+static uint64_t zero_cycles;        /* TSC cycles to zero one page. */
+
+static void vm_fault_around_init (void);
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +65,45 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	frame_init ();
+	vm_fault_around_init ();
+	ksm_init ();
+
+	zero_kva = palloc_get_page (PAL_ASSERT);
+	zero_cycles = rdtsc ();
+	memset (zero_kva, 0, PGSIZE);
+	zero_cycles = rdtsc () - zero_cycles;
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %lld page faults resolved, %lld pages faulted around "
+			"in %lld reads\n", fault_cnt, around_cnt, around_read_cnt);
+	printf ("VM: %lld pages populated in %lld reads\n", populate_cnt,
+			populate_read_cnt);
+	frame_print_stats ();
+	printf ("VM: %lld read faults mapped the zero page, %lld of them "
+			"written to later, about %llu zeroing cycles saved\n",
+			zero_map_cnt, zero_copy_cnt,
+			(zero_map_cnt - zero_copy_cnt) * zero_cycles);
+	printf ("VM: %lld huge pages mapped, %lld attempts found no "
+			"aligned frames\n", huge_cnt, huge_fail_cnt);
+	printf ("VM: %lld stack growth faults added %lld pages, %lld of them "
+			"prefaulted\n", stack_grow_cnt, stack_page_cnt, stack_prefault_cnt);
+	printf ("VM: fault latency:");
+	for (int i = 0; i < FAULT_HIST_CNT; i++)
+		if (fault_hist[i] > 0)
+			printf (" %s2^%d: %lld", i < FAULT_HIST_CNT - 1 ? "<" : ">=",
+					FAULT_HIST_MIN + (i < FAULT_HIST_CNT - 1 ? i : i - 1),
+					fault_hist[i]);
+	printf (" cycles\n");
+	mmap_print_stats ();
+	text_cache_print_stats ();
+	ksm_print_stats ();
+	zswap_print_stats ();
+	swap_print_stats ();
+	vmtrace_print_stats ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -35,6 +123,7 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool vm_map_frame (struct page *page, struct frame *frame);
 static struct frame *vm_evict_frame (void);
 
 /* Create the pending page object with initializer. If you want to create a
@@ -50,94 +139,808 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
 
-		/* TODO: Insert the page into the spt. */
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, pg_round_down (upage), init, type, aux, initializer);
+		page->writable = writable;
+		page->owner = thread_current ();
+
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
 }
 
+/* Supplemental page table.
+
+   The table is a radix tree laid out like the x86-64 page tables
+   themselves: the PML4, PDPE, PDX and PTX fields of a user
+   address index four levels of 512-slot nodes, and the slots of
+   the last level point to the pages.  A lookup or insert is four
+   array accesses however big or sparse the address space is, and
+   since each node takes one page and is allocated only when the
+   first page below it is inserted, the table costs about one page
+   per 2 MB region in use plus the few upper nodes.  Walking the
+   leaves in index order gives the pages in address order, which
+   is what range operations such as fork and munmap want. */
+
+#define SPT_LEVELS 4                    /* Levels of nodes. */
+#define SPT_FANOUT 512                  /* Slots per node. */
+
+/* One node: slots point to child nodes, or to pages in the
+   last level. */
+struct spt_node {
+	void *slots[SPT_FANOUT];
+};
+
+/* Returns the index of VA's slot in a node at LEVEL, where
+   level 0 holds the pages. */
+static inline unsigned
+spt_index (uint64_t va, int level) {
+	return (va >> (PGBITS + 9 * level)) & (SPT_FANOUT - 1);
+}
+
+/* Returns the number of bytes of address space below one slot of
+   a node at LEVEL. */
+static inline uint64_t
+spt_span (int level) {
+	return 1ULL << (PGBITS + 9 * level);
+}
+
+/* Allocates an empty node for SPT.  Returns a null pointer if
+   memory is not available. */
+static struct spt_node *
+spt_node_create (struct supplemental_page_table *spt) {
+	struct spt_node *node = palloc_get_page (PAL_ZERO);
+	if (node != NULL)
+		spt->node_cnt++;
+	return node;
+}
+
+/* Frees NODE, which is at LEVEL, and every node below it. */
+static void
+spt_node_destroy (struct spt_node *node, int level) {
+	if (level > 0)
+		for (int i = 0; i < SPT_FANOUT; i++)
+			if (node->slots[i] != NULL)
+				spt_node_destroy (node->slots[i], level - 1);
+	palloc_free_page (node);
+}
+
+/* Returns the address of the leaf slot for VA in SPT.  If a node
+   on the way is missing, creates it if CREATE is true, and
+   otherwise returns a null pointer.  Also returns a null pointer
+   if a node cannot be allocated. */
+static struct page **
+spt_walk (struct supplemental_page_table *spt, uint64_t va, bool create) {
+	struct spt_node *node;
+
+	if (spt->root == NULL) {
+		if (!create || (spt->root = spt_node_create (spt)) == NULL)
+			return NULL;
+	}
+
+	node = spt->root;
+	for (int level = SPT_LEVELS - 1; level > 0; level--) {
+		void **slot = &node->slots[spt_index (va, level)];
+		if (*slot == NULL) {
+			if (!create || (*slot = spt_node_create (spt)) == NULL)
+				return NULL;
+		}
+		node = *slot;
+	}
+	return (struct page **) &node->slots[spt_index (va, 0)];
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page **slot;
 
-	return page;
+	if (!is_user_vaddr (va))
+		return NULL;
+	slot = spt_walk (spt, (uint64_t) pg_round_down (va), false);
+	return slot != NULL ? *slot : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	struct page **slot;
+
+	ASSERT (pg_ofs (page->va) == 0);
 
-	return succ;
+	if (!is_user_vaddr (page->va))
+		return false;
+	slot = spt_walk (spt, (uint64_t) page->va, true);
+	if (slot == NULL || *slot != NULL)
+		return false;
+	*slot = page;
+	spt->page_cnt++;
+	return true;
 }
 
+/* Removes PAGE from SPT and frees it.  Nodes that become empty
+   are kept until the whole table is killed. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	struct page **slot = spt_walk (spt, (uint64_t) page->va, false);
+
+	ASSERT (slot != NULL && *slot == page);
+	*slot = NULL;
+	spt->page_cnt--;
 	vm_dealloc_page (page);
-	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Initializes IT to iterate over the pages of SPT whose addresses
+   lie in [START, END). */
+void
+spt_first (struct spt_iterator *it, struct supplemental_page_table *spt,
+		void *start, void *end) {
+	it->spt = spt;
+	it->va = (uint64_t) pg_round_down (start);
+	it->end = (uint64_t) pg_round_up (end);
+	if (it->end > KERN_BASE)
+		it->end = KERN_BASE;
+}
+
+/* Returns the next page in IT's range, or a null pointer once the
+   range is exhausted.  Subtrees with no node are skipped as a
+   whole, so the cost depends on the nodes in the range, not on
+   its size. */
+struct page *
+spt_next (struct spt_iterator *it) {
+	while (it->va < it->end && it->spt->root != NULL) {
+		struct spt_node *node = it->spt->root;
+		int level;
+
+		for (level = SPT_LEVELS - 1; level > 0; level--) {
+			node = node->slots[spt_index (it->va, level)];
+			if (node == NULL)
+				break;
+		}
+		if (node == NULL) {
+			it->va = (it->va & ~(spt_span (level) - 1)) + spt_span (level);
+			continue;
+		}
+
+		for (unsigned i = spt_index (it->va, 0);
+				i < SPT_FANOUT && it->va < it->end; i++) {
+			struct page *page = node->slots[i];
+			it->va += PGSIZE;
+			if (page != NULL)
+				return page;
+		}
+	}
+	it->va = it->end;
+	return NULL;
+}
+
+/* Get the struct frame, that will be evicted.  The replacement
+ * policy is chosen at boot, see frame.c. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
-
-	return victim;
+	return frame_victim ();
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.  Keeps the frame table lock throughout,
+ * since the callers of vm_get_frame() may have taken frames out
+ * of the table that no one else must see meanwhile. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	VMTRACE_START (start);
+	struct frame *victim = vm_get_victim ();
 
-	return NULL;
+	if (victim != NULL && !frame_evict (victim, false))
+		victim = NULL;
+	VMTRACE_END (VMTRACE_EVICT, start);
+	return victim;
+}
+
+/* Returns a frame made of a free user page, or a null pointer if
+ * none is free.  Never evicts. */
+static struct frame *
+vm_get_free_frame (void) {
+	void *kva = palloc_get_page (PAL_USER);
+
+	return kva != NULL ? frame_alloc (kva) : NULL;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  Returns a null pointer only if nothing can be
+ * evicted.  The caller must hold the frame table lock. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	VMTRACE_START (start);
+	struct frame *frame = vm_get_free_frame ();
+
+	frame_check_watermark ();
+	if (frame == NULL)
+		frame = vm_evict_frame ();
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	ASSERT (frame == NULL || frame->page == NULL);
+	VMTRACE_END (VMTRACE_GET_FRAME, start);
 	return frame;
 }
 
-/* Growing the stack. */
-static void
-vm_stack_growth (void *addr UNUSED) {
+/* Stack growth.
+
+   A fault below the user stack grows it, provided the address is
+   within STACK_MAX of USER_STACK and no more than 8 bytes below
+   rsp, as a PUSH would touch.  Every page between the fault and
+   the old bottom of the stack joins it, so a large object on the
+   stack costs one fault instead of one per page.
+
+   Deep recursion grows the stack over and over, one fault per
+   page.  Each growth therefore adds twice as many pages as the
+   one before, up to STACK_PREFAULT_MAX pages, or as many as the
+   fault skipped if that is more.  The pages beyond the faulting
+   one are mapped in advance, but only into free frames, so that
+   growth never evicts for a page that may not be used.
+
+   The stack keeps a gap of STACK_GUARD_GAP to any other mapping
+   below it, so that a runaway stack faults before it reaches,
+   say, an mmap() region. */
+
+#define STACK_MAX (1 << 20)             /* Stack size limit. */
+#define STACK_PREFAULT_MAX 16           /* Pages one growth adds, at most. */
+#define STACK_GUARD_GAP (16 * PGSIZE)   /* Free space below the stack. */
+
+/* Returns true if ADDR, which faulted, is a stack access by a
+ * thread whose user stack pointer is RSP. */
+static bool
+is_stack_access (const void *addr, uintptr_t rsp) {
+	uintptr_t va = (uintptr_t) addr;
+
+	return va >= USER_STACK - STACK_MAX && va < USER_STACK && va + 8 >= rsp;
+}
+
+/* Returns true if SPT has a page in the guard gap below VA. */
+static bool
+guard_gap_used (struct supplemental_page_table *spt, uint8_t *va) {
+	for (size_t ofs = PGSIZE; ofs <= STACK_GUARD_GAP; ofs += PGSIZE)
+		if (spt_find_page (spt, va - ofs) != NULL)
+			return true;
+	return false;
+}
+
+/* Maps the page at VA, a new stack page, if a frame is free. */
+static bool
+stack_prefault (struct supplemental_page_table *spt, uint8_t *va) {
+	if (!vm_prefetch_page (spt_find_page (spt, va)))
+		return false;
+	stack_prefault_cnt++;
+	return true;
+}
+
+/* Grows the stack of the current thread down to ADDR, which
+ * faulted, and maps ADDR's page.  Returns true if successful. */
+static bool
+vm_stack_growth (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *fault_pg = pg_round_down (addr);
+	uint8_t *bottom = spt->stack_bottom;
+	uint8_t *low = fault_pg;
+	size_t need, chunk, prefault;
+	uint8_t *va;
+	bool success;
+
+	if (fault_pg >= bottom || guard_gap_used (spt, fault_pg))
+		return false;
+
+	/* Choose the number of pages to add, and extend the range
+	 * below the fault as far as the limit and the gap allow. */
+	need = (bottom - fault_pg) / PGSIZE;
+	chunk = spt->stack_window > 0 ? spt->stack_window * 2 : 1;
+	if (chunk > STACK_PREFAULT_MAX)
+		chunk = STACK_PREFAULT_MAX;
+	if (chunk < need)
+		chunk = need;
+	while ((size_t) (bottom - low) / PGSIZE < chunk
+			&& low - PGSIZE >= (uint8_t *) USER_STACK - STACK_MAX
+			&& spt_find_page (spt, low - PGSIZE - STACK_GUARD_GAP) == NULL)
+		low -= PGSIZE;
+
+	for (va = bottom - PGSIZE; va >= low; va -= PGSIZE) {
+		if (!vm_alloc_page (VM_ANON | VM_STACK, va, true))
+			break;
+		spt->stack_bottom = va;
+		stack_page_cnt++;
+	}
+	if ((uint8_t *) spt->stack_bottom > fault_pg)
+		return false;
+	spt->stack_window = chunk < STACK_PREFAULT_MAX ? chunk : STACK_PREFAULT_MAX;
+	stack_grow_cnt++;
+
+	/* The faulting page first, then the ones above it, which the
+	 * same access is likely to touch, then those below. */
+	frame_lock_acquire ();
+	success = vm_do_claim_page (spt_find_page (spt, fault_pg));
+	prefault = 0;
+	for (va = fault_pg + PGSIZE; success && va < bottom
+			&& prefault < STACK_PREFAULT_MAX
+			&& stack_prefault (spt, va); va += PGSIZE)
+		prefault++;
+	for (va = fault_pg - PGSIZE; success && va >= (uint8_t *) spt->stack_bottom
+			&& prefault < STACK_PREFAULT_MAX
+			&& stack_prefault (spt, va); va -= PGSIZE)
+		prefault++;
+	frame_lock_release ();
+	return success;
 }
 
 /* Handle the fault on write_protected page */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *old = page->frame;
+	struct frame *new;
+	bool success;
+
+	if (!page->writable)
+		return false;
+
+	/* Mapped to the zero page, or evicted while we waited for the
+	 * lock: either way the page gets a private frame now. */
+	if (old == NULL) {
+		if (pml4_get_page (page->owner->pml4, page->va) == zero_kva)
+			zero_copy_cnt++;
+		pml4_clear_page (page->owner->pml4, page->va);
+		return vm_do_claim_page (page);
+	}
+	ksm_write_fault (old);
+
+	/* The last page left on a shared frame takes it over. */
+	if (old->page == page && page->share_next == NULL) {
+		pml4_clear_page (page->owner->pml4, page->va);
+		return pml4_set_page (page->owner->pml4, page->va, old->kva, true);
+	}
+
+	/* Copy the shared frame, keeping it out of the table meanwhile
+	 * so that it cannot be chosen as the victim. */
+	frame_table_remove (old);
+	new = vm_get_frame ();
+	success = new != NULL;
+	if (success) {
+		memcpy (new->kva, old->kva, PGSIZE);
+		pml4_clear_page (page->owner->pml4, page->va);
+		frame_remove_page (old, page);
+		frame_add_page (new, page);
+		success = pml4_set_page (page->owner->pml4, page->va, new->kva, true);
+		ASSERT (success);
+		frame_table_insert (new);
+	}
+	frame_table_insert (old);
+	return success;
+}
+
+/* Fault-around.
+
+   Executable segments and mapped files are loaded lazily, so a
+   program that runs through one takes a fault, and a small file
+   read, for every page.  When such a page faults, its neighbors
+   in the same aligned window of around_pages pages that continue
+   the same run of the same file are loaded along with it, as
+   long as free frames are at hand: the whole run is read from
+   the file at once into around_buf and copied into the frames.
+   The window is a power of two no larger than a page table, so
+   once the faulting page is mapped, mapping its neighbors cannot
+   fail for want of memory.
+
+   vm_populate() reads runs of up to FAULT_AROUND_MAX pages the
+   same way, whatever the window. */
+
+#define FAULT_AROUND_MAX 32         /* Largest window, in pages. */
+
+int vm_fault_around_pages = 16;
+static size_t around_pages;         /* Window in effect; < 2 if off. */
+static uint8_t *around_buf;         /* FAULT_AROUND_MAX pages, or null. */
+
+static void
+vm_fault_around_init (void) {
+	around_pages = 1;
+	around_buf = vmalloc (FAULT_AROUND_MAX * PGSIZE);
+	if (around_buf == NULL)
+		return;
+	while (around_pages * 2 <= (size_t) vm_fault_around_pages
+			&& around_pages * 2 <= FAULT_AROUND_MAX)
+		around_pages *= 2;
+}
+
+/* Returns PAGE's struct file_load if PAGE is a lazily loaded page
+ * that was never loaded, otherwise a null pointer. */
+static struct file_load *
+lazy_file_load (struct page *page) {
+	if (page == NULL || page->frame != NULL
+			|| VM_TYPE (page->operations->type) != VM_UNINIT)
+		return NULL;
+	return page->uninit.aux;
+}
+
+/* Returns true if NEXT, DELTA bytes away from PAGE, is loaded the
+ * same way as PAGE from the same file, at the offset that
+ * corresponds to DELTA. */
+static bool
+same_run (struct page *page, struct page *next, int64_t delta) {
+	struct file_load *load = page->uninit.aux;
+	struct file_load *next_load = lazy_file_load (next);
+
+	return next_load != NULL
+		&& next->uninit.init == page->uninit.init
+		&& next->uninit.type == page->uninit.type
+		&& file_get_inode (next_load->fh->file)
+			== file_get_inode (load->fh->file)
+		&& next_load->ofs == load->ofs + delta;
+}
+
+/* Fills FRAMES with the CNT pages PAGES, a run of lazily loaded
+ * pages in which each page but the last is full, with a single
+ * read from the file, and marks them filled.  Returns false if
+ * the read falls short. */
+static bool
+read_run (struct page *pages[], struct frame *frames[], size_t cnt) {
+	struct file_load *first = pages[0]->uninit.aux;
+	struct file_load *last = pages[cnt - 1]->uninit.aux;
+	off_t size = (cnt - 1) * PGSIZE + last->read_bytes;
+
+	ASSERT (cnt <= FAULT_AROUND_MAX);
+
+	if (file_read_at (first->fh->file, around_buf, size, first->ofs) != size)
+		return false;
+	for (size_t i = 0; i < cnt; i++) {
+		struct file_load *load = pages[i]->uninit.aux;
+		memcpy (frames[i]->kva, around_buf + i * PGSIZE, load->read_bytes);
+		memset (frames[i]->kva + load->read_bytes, 0,
+				PGSIZE - load->read_bytes);
+		load->filled = true;
+	}
+	return true;
+}
+
+/* Tries to load PAGE, which faulted, together with its neighbors.
+ * Returns false if it did nothing because PAGE is not lazily
+ * loaded from a file, has no neighbors to load with it, or free
+ * frames are short.  Otherwise stores in *SUCCESS whether PAGE
+ * was loaded and returns true.  The caller must hold the frame
+ * table lock. */
+static bool
+vm_fault_around (struct page *page, bool *success) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	struct page *pages[FAULT_AROUND_MAX];
+	struct frame *frames[FAULT_AROUND_MAX];
+	struct file_load *last;
+	uint8_t *start, *end, *va;
+	size_t cnt = 0, i;
+
+	if (around_pages < 2 || lazy_file_load (page) == NULL
+			|| text_cache_lookup (page) != NULL)
+		return false;
+
+	/* Find the run: every page in it but the last is full. */
+	start = (uint8_t *) page->va - pg_no (page->va) % around_pages * PGSIZE;
+	end = start + around_pages * PGSIZE;
+	for (va = page->va; va > start; va -= PGSIZE) {
+		struct page *prev = spt_find_page (spt, va - PGSIZE);
+		if (!same_run (page, prev, va - PGSIZE - (uint8_t *) page->va)
+				|| lazy_file_load (prev)->read_bytes != PGSIZE)
+			break;
+	}
+	for (last = NULL; va < end; va += PGSIZE) {
+		struct page *p = spt_find_page (spt, va);
+		if ((last != NULL && last->read_bytes != PGSIZE)
+				|| !same_run (page, p, va - (uint8_t *) page->va)
+				|| (p != page && text_cache_lookup (p) != NULL))
+			break;
+		pages[cnt++] = p;
+		last = p->uninit.aux;
+	}
+	if (cnt < 2)
+		return false;
+
+	for (i = 0; i < cnt; i++)
+		if ((frames[i] = vm_get_free_frame ()) == NULL)
+			goto fail;
+
+	if (!read_run (pages, frames, cnt))
+		goto fail;
+	around_read_cnt++;
+
+	/* The faulting page first: then the page table exists. */
+	i = ((uint8_t *) page->va - (uint8_t *) pages[0]->va) / PGSIZE;
+	*success = vm_map_frame (page, frames[i]);
+	frames[i] = NULL;
+	for (i = 0; i < cnt; i++) {
+		if (frames[i] == NULL)
+			continue;
+		if (*success) {
+			if (vm_map_frame (pages[i], frames[i]))
+				around_cnt++;
+		} else {
+			((struct file_load *) pages[i]->uninit.aux)->filled = false;
+			palloc_free_page (frames[i]->kva);
+		}
+	}
+	return true;
+
+fail:
+	while (i-- > 0)
+		palloc_free_page (frames[i]->kva);
+	return false;
+}
+
+/* Loads the pages of the current process in [START, END) that
+ * are not mapped yet, as their faults would, except that each
+ * run of pages that continue one file, up to FAULT_AROUND_MAX
+ * pages, is read with a single file read.  Evicts frames for
+ * them as needed, and stops once memory runs out. */
+void
+vm_populate (void *start, void *end) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *pages[FAULT_AROUND_MAX];
+	struct frame *frames[FAULT_AROUND_MAX];
+	struct spt_iterator it;
+	struct page *page;
+	bool success = true;
+
+	spt_first (&it, spt, start, end);
+	while (success && (page = spt_next (&it)) != NULL) {
+		size_t cnt = 1, got, i;
+
+		if (page->frame != NULL
+				|| pml4_get_page (page->owner->pml4, page->va) != NULL)
+			continue;
+
+		frame_lock_acquire ();
+		if (around_buf == NULL || lazy_file_load (page) == NULL
+				|| text_cache_lookup (page) != NULL) {
+			success = vm_do_claim_page (page);
+			frame_lock_release ();
+			continue;
+		}
+
+		/* Find the run: every page in it but the last is full. */
+		pages[0] = page;
+		while (cnt < FAULT_AROUND_MAX
+				&& (uint8_t *) page->va + cnt * PGSIZE < (uint8_t *) end
+				&& ((struct file_load *) pages[cnt - 1]->uninit.aux)->read_bytes
+					== PGSIZE) {
+			struct page *next =
+				spt_find_page (spt, (uint8_t *) page->va + cnt * PGSIZE);
+			if (!same_run (page, next, cnt * PGSIZE)
+					|| text_cache_lookup (next) != NULL)
+				break;
+			pages[cnt++] = next;
+		}
+
+		for (got = 0; got < cnt; got++)
+			if ((frames[got] = vm_get_frame ()) == NULL)
+				break;
+		if (got == cnt && read_run (pages, frames, cnt)) {
+			populate_read_cnt++;
+			for (i = 0; i < cnt; i++)
+				if (vm_map_frame (pages[i], frames[i]))
+					populate_cnt++;
+				else
+					success = false;
+		} else {
+			success = false;
+			for (i = 0; i < got; i++) {
+				((struct file_load *) pages[i]->uninit.aux)->filled = false;
+				palloc_free_page (frames[i]->kva);
+			}
+		}
+		frame_lock_release ();
+	}
+}
+
+/* Zero page.
+
+   A lazy anonymous page with nothing to load, such as a page of
+   the BSS, of lazily allocated memory or of the stack, reads as
+   zeros until it is first written.  If its first access is a
+   read, it is mapped read-only to zero_kva, one page of zeros
+   that all processes share, and becomes an anonymous page
+   without a frame.  The write fault that follows, if any, goes
+   to vm_handle_wp(), which gives the page a frame of its own;
+   an anonymous page with neither a frame nor a swap slot is
+   zero-filled there. */
+
+/* Returns true if PAGE is a lazy anonymous page whose contents
+ * are all zeros. */
+static bool
+vm_is_zero_page (struct page *page) {
+	struct file_load *load;
+
+	if (VM_TYPE (page->operations->type) != VM_UNINIT
+			|| VM_TYPE (page->uninit.type) != VM_ANON)
+		return false;
+	load = page->uninit.aux;
+	return load == NULL ? page->uninit.init == NULL : load->read_bytes == 0;
+}
+
+/* Turns PAGE, for which vm_is_zero_page() is true, into an
+ * anonymous page, without loading anything. */
+static void
+vm_init_zero_page (struct page *page, void *kva) {
+	struct uninit_page *uninit = &page->uninit;
+	struct file_load *load = uninit->aux;
+
+	uninit->page_initializer (page, uninit->type, kva);
+	file_load_free (load);
+}
+
+/* Maps PAGE, for which vm_is_zero_page() is true, to the zero
+ * page. */
+static bool
+vm_map_zero_page (struct page *page) {
+	if (!pml4_set_page (page->owner->pml4, page->va, zero_kva, false))
+		return false;
+	vm_init_zero_page (page, zero_kva);
+	zero_map_cnt++;
+	return true;
+}
+
+/* Huge pages.
+
+   The first write to a lazy zero-filled anonymous page tries to
+   map the whole 2 MB-aligned region around it at once, with a
+   huge page.  That takes every page of the region to be such a
+   page, with the same permissions, and HUGE_PGCNT free frames in
+   the user pool that are aligned to 2 MB.  One fault then zeroes
+   and maps all of them, and the region takes one TLB entry
+   instead of 512.
+
+   Each page still gets a frame of its own in the frame table, so
+   eviction, fork and destruction go on 4 kB at a time.  The
+   first of them to change one page's PTE splits the huge page
+   (see threads/mmu.c). */
+
+bool vm_huge_pages = true;
+
+/* Returns true if PAGE may share a huge page with LEADER. */
+static bool
+huge_candidate (struct page *page, struct page *leader) {
+	return page != NULL && vm_is_zero_page (page)
+		&& page->writable == leader->writable
+		&& !(page->uninit.type & VM_STACK)
+		&& pml4_get_page (page->owner->pml4, page->va) == NULL;
+}
+
+/* Tries to map the 2 MB region around PAGE, for which
+ * vm_is_zero_page() is true, with a huge page.  Returns true if
+ * successful.  The caller must hold the frame table lock. */
+static bool
+vm_map_huge_page (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	uint8_t *base = (uint8_t *) ((uint64_t) page->va & ~(HUGE_PGSIZE - 1));
+	uint8_t *kva;
+	size_t i;
+
+	if (!vm_huge_pages)
+		return false;
+	for (i = 0; i < HUGE_PGCNT; i++)
+		if (!huge_candidate (spt_find_page (spt, base + i * PGSIZE), page))
+			return false;
+
+	kva = palloc_get_aligned (PAL_USER | PAL_ZERO, HUGE_PGCNT);
+	if (kva == NULL) {
+		huge_fail_cnt++;
+		return false;
+	}
+	if (!pml4_set_huge_page (page->owner->pml4, base, kva, page->writable)) {
+		for (i = 0; i < HUGE_PGCNT; i++)
+			palloc_free_page (kva + i * PGSIZE);
+		return false;
+	}
+
+	for (i = 0; i < HUGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		struct frame *frame = frame_alloc (kva + i * PGSIZE);
+
+		vm_init_zero_page (p, frame->kva);
+		frame_add_page (frame, p);
+		frame_table_insert (frame);
+	}
+	huge_cnt++;
+	frame_check_watermark ();
+	return true;
+}
+
+/* Returns true if loading PAGE, which has no frame, will read a
+ * file or the swap disk.  The caller must hold the frame table
+ * lock. */
+static bool
+load_needs_io (struct page *page) {
+	struct file_load *load;
+
+	if (page->frame != NULL || text_cache_lookup (page) != NULL)
+		return false;
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			load = page->uninit.aux;
+			return load != NULL && load->read_bytes > 0 && !load->filled;
+		case VM_ANON:
+			return page->anon.slot != SWAP_SLOT_NONE;
+		default:
+			return true;
+	}
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+	uint64_t start;
+	bool success, major;
+
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	VMTRACE_START (trace_start);
+	page = spt_find_page (spt, addr);
+	VMTRACE_END (VMTRACE_LOOKUP, trace_start);
+	if (page == NULL) {
+		uintptr_t rsp = user ? f->rsp : thread_current ()->user_rsp;
+
+		if (!not_present || !is_stack_access (addr, rsp)
+				|| !vm_stack_growth (addr))
+			return false;
+		fault_cnt++;
+		thread_current ()->vmstat.minor_faults++;
+		return true;
+	}
+	if (write && !page->writable)
+		return false;
+	if (!not_present && !write)
+		return false;
+
+	fault_cnt++;
+	start = rdtsc ();
+	VMTRACE_START (lock_start);
+	frame_lock_acquire ();
+	frame_wait_io (page);
+	VMTRACE_END (VMTRACE_LOCK, lock_start);
+	major = not_present && load_needs_io (page);
+	if (!not_present)
+		success = vm_handle_wp (page);
+	else if (!write && vm_is_zero_page (page))
+		success = vm_map_zero_page (page);
+	else if (write && vm_is_zero_page (page) && vm_map_huge_page (page))
+		success = true;
+	else if (!vm_fault_around (page, &success))
+		success = vm_do_claim_page (page);
+	frame_lock_release ();
+	fault_hist_add (rdtsc () - start);
+	VMTRACE_END (VMTRACE_FAULT, trace_start);
+	if (success && major)
+		thread_current ()->vmstat.major_faults++;
+	else if (success)
+		thread_current ()->vmstat.minor_faults++;
 
-	return vm_do_claim_page (page);
+	if (success && not_present && page_get_type (page) == VM_FILE)
+		mmap_readahead (page);
+	return success;
 }
 
 /* Free the page.
@@ -150,41 +953,426 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
+	bool success;
 
-	return vm_do_claim_page (page);
+	if (page == NULL)
+		return false;
+	frame_lock_acquire ();
+	success = vm_do_claim_page (page);
+	frame_lock_release ();
+	return success;
 }
 
-/* Claim the PAGE and set up the mmu. */
+/* Claim the PAGE and set up the mmu.  The caller must hold the
+ * frame table lock. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct frame *frame;
+
+	/* Someone else brought it in while we waited for the lock. */
+	frame_wait_io (page);
+	if (page->frame != NULL)
+		return true;
+
+	frame = text_cache_lookup (page);
+	if (frame != NULL)
+		return text_cache_map (page, frame);
+
+	frame = vm_get_frame ();
+	if (frame == NULL)
+		return false;
+	return vm_map_frame (page, frame);
+}
+
+/* Loads PAGE, which has no frame, into a free frame and maps it,
+ * but never evicts for it.  Returns false if no frame is free or
+ * loading fails.  The caller must hold the frame table lock. */
+bool
+vm_prefetch_page (struct page *page) {
+	struct frame *frame;
+
+	ASSERT (page->frame == NULL);
+
+	frame = vm_get_free_frame ();
+	return frame != NULL && vm_map_frame (page, frame);
+}
+
+/* Loads PAGE into FRAME, a frame that no page maps, and maps it.
+ * On failure frees FRAME.  The caller must hold the frame table
+ * lock, which is dropped while the page is read. */
+static bool
+vm_map_frame (struct page *page, struct frame *frame) {
+	bool io = load_needs_io (page);
+	bool loaded;
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_add_page (frame, page);
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	/* Fill the frame before mapping it, so that the owner never
+	 * sees a half-loaded page.  A read from a file or the swap
+	 * disk goes on without the frame table lock, and faults on
+	 * PAGE wait for it meanwhile (see frame_io_begin()). */
+	VMTRACE_START (start);
+	if (io)
+		frame_io_begin (frame);
+	loaded = swap_in (page, frame->kva);
+	if (io)
+		frame_io_end (frame);
+	VMTRACE_END (VMTRACE_SWAP_IN, start);
+	if (!loaded
+			|| !pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		frame_remove_page (frame, page);
+		palloc_free_page (frame->kva);
+		return false;
+	}
+	text_cache_insert (page, frame);
+	frame_table_insert (frame);
+	return true;
+}
 
-	return swap_in (page, frame->kva);
+/* Teardown.
+
+   When a process exits, or replaces itself with exec(), its page
+   table goes away right after its pages, so there is no need to
+   clear each page's PTE first.  While supplemental_page_table_kill()
+   runs, vm_free_frame() leaves the PTEs alone, which also spares
+   huge pages from being split one page at a time, and gathers
+   the freed frames in a batch that goes back to the user pool
+   with one call to palloc_free_batch().  The page table itself
+   is destroyed later by kswapd (see frame_defer_destroy()). */
+
+#define FREE_BATCH 32               /* Frames per palloc_free_batch(). */
+
+/* Frames waiting to be returned to the user pool. */
+struct free_batch {
+	void *kva[FREE_BATCH];
+	size_t cnt;
+};
+
+/* Returns the frames in BATCH to the user pool. */
+static void
+free_batch_flush (struct free_batch *batch) {
+	palloc_free_batch (batch->kva, batch->cnt);
+	batch->cnt = 0;
+}
+
+/* Unmaps PAGE from its owner's page table and returns its frame,
+ * if any, to the user pool once no other page maps it.  The page
+ * types call this when a page is destroyed. */
+void
+vm_free_frame (struct page *page) {
+	struct free_batch *batch = page->owner->spt.free_batch;
+	struct frame *frame;
+
+	frame_lock_acquire ();
+	frame_wait_io (page);
+	frame_forget (page);
+	frame = page->frame;
+
+	/* A page without a frame may still map the zero page. */
+	if (page->owner->pml4 != NULL && batch == NULL)
+		pml4_clear_page (page->owner->pml4, page->va);
+	if (frame != NULL) {
+		frame_remove_page (frame, page);
+		if (frame->page == NULL) {
+			frame_table_remove (frame);
+			text_cache_remove (frame);
+			if (batch != NULL) {
+				batch->kva[batch->cnt++] = frame->kva;
+				if (batch->cnt == FREE_BATCH)
+					free_batch_flush (batch);
+			} else
+				palloc_free_page (frame->kva);
+		}
+	}
+	frame_lock_release ();
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->root = NULL;
+	spt->page_cnt = 0;
+	spt->node_cnt = 0;
+	list_init (&spt->mmap_list);
+	spt->free_batch = NULL;
+	spt->stack_bottom = (void *) USER_STACK;
+	spt->stack_window = 0;
+}
+
+/* Makes COPY, a new uninit page of the current thread, an
+ * anonymous page that shares PAGE's frame copy-on-write: both
+ * are mapped read-only, and the first write through either one
+ * goes to vm_handle_wp().  The caller must hold the frame table
+ * lock. */
+static bool
+vm_share_page (struct page *page, struct page *copy) {
+	struct frame *frame;
+
+	if (!vm_do_claim_page (page))
+		return false;
+	frame = page->frame;
+
+	if (!pml4_set_page (copy->owner->pml4, copy->va, frame->kva, false))
+		return false;
+	anon_initializer (copy, VM_ANON, frame->kva);
+	frame_add_page (frame, copy);
+
+	/* The PTE exists already, so this cannot fail. */
+	pml4_clear_page (page->owner->pml4, page->va);
+	pml4_set_page (page->owner->pml4, page->va, frame->kva, false);
+	return true;
 }
 
-/* Copy supplemental page table from src to dst */
+/* Copy supplemental page table from src to dst.  Runs in the
+ * thread that owns DST.  Pages that were never touched stay lazy
+ * in the copy, with their own copy of the loading information.
+ * Anonymous pages share their frame with the copy until one side
+ * writes to it.  Text pages become lazy pages in the copy, which
+ * find the frame through the text cache.  Pages of mapped files
+ * become private anonymous pages, since the copy inherits no
+ * mappings to write them back to: those already loaded are
+ * copied now, the others are loaded from the file on their first
+ * fault. */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct spt_iterator it;
+	struct page *page;
+
+	ASSERT (dst == &thread_current ()->spt);
+
+	spt_first (&it, src, NULL, (void *) KERN_BASE);
+	while ((page = spt_next (&it)) != NULL) {
+		struct file_load *aux = NULL;
+		vm_initializer *init = NULL;
+		enum vm_type type = VM_ANON;
+		bool lazy, dup_ok = true;
+
+		/* Look at a lazy page under the frame table lock: the
+		 * readahead thread may be loading it. */
+		frame_lock_acquire ();
+		frame_wait_io (page);
+		lazy = VM_TYPE (page->operations->type) == VM_UNINIT;
+		if (lazy) {
+			type = page->uninit.type;
+			init = page->uninit.init;
+			aux = page->uninit.aux;
+			if (aux != NULL)
+				dup_ok = (aux = file_load_dup (aux)) != NULL;
+		}
+		frame_lock_release ();
+		if (!dup_ok)
+			return false;
+
+		if (lazy) {
+			if (VM_TYPE (type) == VM_FILE && !(type & VM_TEXT)) {
+				type = VM_ANON;
+				init = file_load_anon;
+			}
+			if (!vm_alloc_page_with_initializer (type, page->va,
+						page->writable, init, aux)) {
+				file_load_free (aux);
+				return false;
+			}
+		} else if (VM_TYPE (page->operations->type) == VM_FILE
+				&& page->file.text) {
+			struct file_page *file_page = &page->file;
+
+			aux = file_load_create (file_page->fh, file_page->ofs,
+					file_page->read_bytes);
+			if (aux == NULL)
+				return false;
+			if (!vm_alloc_page_with_initializer (VM_FILE | VM_TEXT, page->va,
+						false, file_backed_load, aux)) {
+				file_load_free (aux);
+				return false;
+			}
+		} else {
+			struct page *copy;
+			bool success;
+
+			if (!vm_alloc_page (VM_ANON, page->va, page->writable))
+				return false;
+			copy = spt_find_page (dst, page->va);
+
+			frame_lock_acquire ();
+			if (VM_TYPE (page->operations->type) == VM_ANON
+					&& page->frame == NULL
+					&& pml4_get_page (page->owner->pml4, page->va) == zero_kva)
+				success = true;     /* COPY is a lazy zero page already. */
+			else if (VM_TYPE (page->operations->type) == VM_ANON)
+				success = vm_share_page (page, copy);
+			else if ((success = vm_do_claim_page (page))) {
+				/* Keep the source frame out of the table while the
+				 * copy gets its frame, so that it cannot be the
+				 * victim. */
+				struct frame *frame = page->frame;
+
+				frame_table_remove (frame);
+				success = vm_do_claim_page (copy);
+				if (success)
+					memcpy (copy->frame->kva, frame->kva, PGSIZE);
+				frame_table_insert (frame);
+			}
+			frame_lock_release ();
+			if (!success)
+				return false;
+		}
+	}
+	dst->stack_bottom = src->stack_bottom;
+	dst->stack_window = src->stack_window;
+	return true;
 }
 
-/* Free the resource hold by the supplemental page table */
+/* Free the resource hold by the supplemental page table.  The
+ * caller must destroy the page table of its thread right after,
+ * since the PTEs of the pages are left in place (see
+ * "Teardown" above). */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	struct free_batch batch;
+	struct spt_iterator it;
+	struct page *page;
+
+	batch.cnt = 0;
+	spt->free_batch = &batch;
+	while (!list_empty (&spt->mmap_list))
+		mmap_region_remove (spt, list_entry (list_front (&spt->mmap_list),
+					struct mmap_region, elem));
+
+	spt_first (&it, spt, NULL, (void *) KERN_BASE);
+	while ((page = spt_next (&it)) != NULL)
+		vm_dealloc_page (page);
+	free_batch_flush (&batch);
+	if (spt->root != NULL)
+		spt_node_destroy (spt->root, SPT_LEVELS - 1);
+	supplemental_page_table_init (spt);
+}
+
+/* madvise().
+
+   MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL tune the
+   readahead of the mapped files in the range (see vm/file.c).
+   MADV_WILLNEED hands the mapped file pages to the readahead
+   thread and brings in the anonymous pages that were swapped
+   out, or not yet loaded, right away, into free frames only.
+   MADV_DONTNEED frees the frames and swap slots of the pages:
+   anonymous pages read as zeros afterward, and file-backed pages
+   are written back and read from the file again. */
+
+/* Returns true if MADV_WILLNEED should load PAGE now. */
+static bool
+willneed_page (struct page *page) {
+	if (page->frame != NULL || page_get_type (page) != VM_ANON)
+		return false;
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return !vm_is_zero_page (page);
+	return page->anon.slot != SWAP_SLOT_NONE || page->anon.zentry != NULL;
+}
+
+/* Applies ADVICE to the pages of the current process in
+ * [ADDR, ADDR + LENGTH).  Returns 0 if successful, -1 if ADDR is
+ * not page-aligned, the range is not in user space or ADVICE is
+ * unknown. */
+int
+do_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start = addr, *end;
+	struct spt_iterator it;
+	struct page *page;
+
+	if (pg_ofs (addr) != 0 || !is_user_vaddr (addr)
+			|| length > KERN_BASE - (uint64_t) addr)
+		return -1;
+	end = start + ROUND_UP (length, PGSIZE);
+
+	switch (advice) {
+		case MADV_NORMAL:
+		case MADV_RANDOM:
+		case MADV_SEQUENTIAL:
+			mmap_advise (spt, start, end, advice);
+			return 0;
+
+		case MADV_WILLNEED:
+			mmap_advise (spt, start, end, advice);
+			spt_first (&it, spt, start, end);
+			frame_lock_acquire ();
+			while ((page = spt_next (&it)) != NULL)
+				if (willneed_page (page) && !vm_prefetch_page (page))
+					break;
+			frame_lock_release ();
+			return 0;
+
+		case MADV_DONTNEED:
+			spt_first (&it, spt, start, end);
+			while ((page = spt_next (&it)) != NULL)
+				if (VM_TYPE (page->operations->type) == VM_ANON)
+					anon_discard (page);
+				else if (VM_TYPE (page->operations->type) == VM_FILE)
+					file_backed_discard (page);
+			return 0;
+
+		default:
+			return -1;
+	}
+}
+
+/* Per-process statistics.
+
+   Each thread keeps the counters of struct vmstat for its pages:
+   faults in vm_try_handle_fault(), resident pages in
+   frame_add_page() and frame_remove_page(), evictions in
+   frame_evict(), and swap use in the anonymous page code.  A
+   fault is major if it reads the page from a file or the swap
+   disk, and minor otherwise, including zswap hits. */
+
+bool vm_exit_stats;
+
+/* Copies SIZE bytes from SRC to UDST in the current process's
+ * memory, if every page of the destination is a writable page of
+ * the process.  Returns true if successful. */
+static bool
+copy_out (void *udst, const void *src, size_t size) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *va;
+
+	if (size == 0)
+		return true;
+	if (udst == NULL || !is_user_vaddr (udst)
+			|| size > KERN_BASE - (uint64_t) udst)
+		return false;
+	for (va = pg_round_down (udst); va < (uint8_t *) udst + size;
+			va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+		if (page == NULL || !page->writable)
+			return false;
+	}
+	memcpy (udst, src, size);
+	return true;
+}
+
+/* Stores the statistics of the current process in *USTAT, in user
+ * memory.  Returns false if USTAT is not writable. */
+bool
+do_get_vmstat (struct vmstat *ustat) {
+	struct vmstat stat = thread_current ()->vmstat;
+
+	return copy_out (ustat, &stat, sizeof stat);
+}
+
+/* Prints the statistics of the current process, which is
+ * exiting. */
+void
+vm_print_exit_stats (void) {
+	struct thread *t = thread_current ();
+	const struct vmstat *stat = &t->vmstat;
+
+	printf ("%s: %lld minor faults, %lld major faults, %lld evictions, "
+			"%lld swap-ins, %zu pages resident (max %zu), %zu in swap\n",
+			t->name, stat->minor_faults, stat->major_faults, stat->evictions,
+			stat->swap_ins, stat->rss, stat->max_rss, stat->swap_pages);
 }
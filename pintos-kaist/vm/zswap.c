@@ -0,0 +1,231 @@
+/* zswap.c: Compressed in-memory store in front of the swap disk. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <list.h>
+#include <lz.h>
+#include <stdio.h>
+#include <string.h>
+#include "intrinsic.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+#include "vm/swap.h"
+
+/* An anonymous page being evicted goes here first.  The store
+   keeps it compressed in kernel memory, where bringing it back
+   costs a decompression instead of a trip to the swap disk.
+
+   Pages filled with one repeated 64-bit word, most of all zero
+   pages, keep only the word.  Pages that do not compress to
+   MAX_SIZE bytes or less go straight to disk.
+
+   The store holds at most pool_limit bytes of compressed data.
+   To make room, it writes the entries it stored longest ago out
+   to the swap disk; their owners then find their pages there.
+
+   zswap_lock covers the store and the `zentry' member of every
+   anon_page.  An entry leaves the store only with the lock held,
+   after its page's `slot' is set if it went to disk. */
+
+#define MAX_SIZE (PGSIZE * 3 / 4)   /* Largest compressed page kept. */
+
+/* A page in the store. */
+struct zswap_entry {
+	struct anon_page *owner;        /* Page whose contents these are. */
+	struct list_elem lru_elem;      /* In lru_list, unless same-filled. */
+	size_t size;                    /* Compressed size; 0 if same-filled. */
+	uint64_t fill;                  /* Repeated word, if same-filled. */
+	uint8_t data[];                 /* Compressed contents. */
+};
+
+int zswap_max_percent = 20;
+
+static struct lock zswap_lock;
+static struct list lru_list;        /* Compressed entries, oldest first. */
+static size_t pool_size;            /* Bytes of compressed data held. */
+static size_t pool_limit;           /* Most bytes of compressed data. */
+static uint8_t *cbuf;               /* Compression output. */
+static uint8_t *wbuf;               /* Page being written back. */
+static uint8_t work[LZ_WORK_SIZE];  /* Compressor scratch space. */
+
+/* Statistics. */
+static long long try_cnt;           /* Calls to zswap_store(). */
+static long long store_cnt;         /* Pages stored compressed. */
+static long long same_cnt;          /* Pages stored as a fill word. */
+static long long reject_cnt;        /* Pages that did not compress. */
+static long long load_cnt;          /* Swap-ins of anonymous pages. */
+static long long hit_cnt;           /* ...served from the store. */
+static long long writeback_cnt;     /* Entries written back to disk. */
+static long long compressed_bytes;  /* Sum of sizes stored. */
+static uint64_t store_cycles;       /* TSC cycles in zswap_store(). */
+static uint64_t load_cycles;        /* TSC cycles in hits. */
+
+/* Initializes the store.  With a zero -zswap limit, every page
+   goes to the swap disk. */
+void
+zswap_init (void) {
+	lock_init (&zswap_lock);
+	list_init (&lru_list);
+	if (zswap_max_percent <= 0)
+		return;
+
+	pool_limit = palloc_free_cnt (PAL_USER) * PGSIZE / 100 * zswap_max_percent;
+	cbuf = palloc_get_page (PAL_ASSERT);
+	wbuf = palloc_get_page (PAL_ASSERT);
+}
+
+/* Returns true if the page at KVA is one 64-bit word repeated,
+   and stores the word in *FILL. */
+static bool
+same_filled (const void *kva, uint64_t *fill) {
+	const uint64_t *w = kva;
+
+	for (size_t i = 1; i < PGSIZE / sizeof *w; i++)
+		if (w[i] != w[0])
+			return false;
+	*fill = w[0];
+	return true;
+}
+
+/* Writes the contents of E into the page at KVA. */
+static void
+entry_read (const struct zswap_entry *e, void *kva) {
+	if (e->size == 0) {
+		uint64_t *w = kva;
+
+		for (size_t i = 0; i < PGSIZE / sizeof *w; i++)
+			w[i] = e->fill;
+	} else if (lz_decompress (e->data, e->size, kva, PGSIZE) != PGSIZE)
+		PANIC ("zswap: corrupt entry");
+}
+
+/* Removes E from the store and frees it. */
+static void
+entry_free (struct zswap_entry *e) {
+	e->owner->zentry = NULL;
+	if (e->size > 0) {
+		list_remove (&e->lru_elem);
+		pool_size -= e->size;
+	}
+	free (e);
+}
+
+/* Writes the oldest compressed entry out to the swap disk.
+   Returns false if there is none or the swap disk is full. */
+static bool
+write_back_oldest (void) {
+	struct zswap_entry *e;
+	swap_slot_t slot;
+
+	if (list_empty (&lru_list))
+		return false;
+	e = list_entry (list_front (&lru_list), struct zswap_entry, lru_elem);
+	entry_read (e, wbuf);
+	slot = swap_write (wbuf);
+	if (slot == SWAP_SLOT_NONE)
+		return false;
+	e->owner->slot = slot;
+	entry_free (e);
+	writeback_cnt++;
+	return true;
+}
+
+/* Tries to keep the page at KVA, the contents of ANON, in the
+   store.  Returns true if successful, false if the page belongs
+   on the swap disk. */
+bool
+zswap_store (struct anon_page *anon, const void *kva) {
+	struct zswap_entry *e = NULL;
+	uint64_t start = rdtsc ();
+	uint64_t fill = 0;
+	size_t size = 0;
+
+	ASSERT (anon->zentry == NULL);
+
+	if (pool_limit == 0)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	try_cnt++;
+	if (!same_filled (kva, &fill)) {
+		size = lz_compress (kva, PGSIZE, cbuf, MAX_SIZE, work);
+		if (size == 0) {
+			reject_cnt++;
+			goto done;
+		}
+		while (pool_size + size > pool_limit)
+			if (!write_back_oldest ())
+				goto done;
+	}
+
+	e = malloc (sizeof *e + size);
+	if (e == NULL)
+		goto done;
+	e->owner = anon;
+	e->size = size;
+	e->fill = fill;
+	anon->zentry = e;
+	if (size > 0) {
+		memcpy (e->data, cbuf, size);
+		list_push_back (&lru_list, &e->lru_elem);
+		pool_size += size;
+		compressed_bytes += size;
+		store_cnt++;
+	} else
+		same_cnt++;
+
+done:
+	store_cycles += rdtsc () - start;
+	lock_release (&zswap_lock);
+	return e != NULL;
+}
+
+/* If ANON is in the store, reads it into the page at KVA, removes
+   it from the store and returns true.  Otherwise returns false. */
+bool
+zswap_load (struct anon_page *anon, void *kva) {
+	struct zswap_entry *e;
+	uint64_t start = rdtsc ();
+
+	lock_acquire (&zswap_lock);
+	load_cnt++;
+	e = anon->zentry;
+	if (e != NULL) {
+		entry_read (e, kva);
+		entry_free (e);
+		hit_cnt++;
+		load_cycles += rdtsc () - start;
+	}
+	lock_release (&zswap_lock);
+	return e != NULL;
+}
+
+/* Drops ANON from the store, if it is there. */
+void
+zswap_invalidate (struct anon_page *anon) {
+	lock_acquire (&zswap_lock);
+	if (anon->zentry != NULL)
+		entry_free (anon->zentry);
+	lock_release (&zswap_lock);
+}
+
+/* Prints statistics for the store. */
+void
+zswap_print_stats (void) {
+	long long stored = store_cnt + same_cnt;
+
+	if (pool_limit == 0)
+		return;
+	printf ("Zswap: %lld pages stored (%lld same-filled), %lld rejected, "
+			"%lld written back, %zu of %zu bytes used\n",
+			stored, same_cnt, reject_cnt, writeback_cnt, pool_size, pool_limit);
+	printf ("Zswap: compressed to %lld%%, %lld of %lld swap-ins hit, "
+			"%llu cycles/store, %llu cycles/hit\n",
+			store_cnt > 0 ? compressed_bytes * 100 / (store_cnt * PGSIZE) : 0,
+			hit_cnt, load_cnt,
+			try_cnt > 0 ? store_cycles / try_cnt : 0,
+			hit_cnt > 0 ? load_cycles / hit_cnt : 0);
+}